@@ -0,0 +1,77 @@
+# Compare two Google Benchmark JSON reports:
+#
+#   cmake -DBASELINE=baseline.json -DRESULT=result.json [-DTHRESHOLD=20] -P compare.cmake
+#
+# Prints the throughput change of every benchmark in both reports and fails
+# if any dropped by more than THRESHOLD percent.
+cmake_minimum_required(VERSION 3.19)
+
+if(NOT BASELINE OR NOT RESULT)
+    message(FATAL_ERROR "usage: cmake -DBASELINE=old.json -DRESULT=new.json [-DTHRESHOLD=percent] -P compare.cmake")
+endif()
+if(NOT DEFINED THRESHOLD)
+    set(THRESHOLD 20)
+endif()
+
+file(READ ${BASELINE} baselineJson)
+file(READ ${RESULT} resultJson)
+
+# Different kernels make for meaningless comparisons; say so up front
+string(JSON baselineKernel ERROR_VARIABLE missing GET ${baselineJson} context otp_kernel)
+string(JSON resultKernel ERROR_VARIABLE missing GET ${resultJson} context otp_kernel)
+if(NOT baselineKernel STREQUAL resultKernel)
+    message(WARNING "baseline ran the ${baselineKernel} kernels, this run ${resultKernel}")
+endif()
+
+# name -> bytes_per_second of the baseline
+string(JSON count LENGTH ${baselineJson} benchmarks)
+math(EXPR last "${count} - 1")
+foreach(i RANGE ${last})
+    string(JSON name GET ${baselineJson} benchmarks ${i} name)
+    string(JSON rate ERROR_VARIABLE missing GET ${baselineJson} benchmarks ${i} bytes_per_second)
+    if(NOT missing)
+        set("baseline_${name}" ${rate})
+    endif()
+endforeach()
+
+set(regressions 0)
+string(JSON count LENGTH ${resultJson} benchmarks)
+math(EXPR last "${count} - 1")
+foreach(i RANGE ${last})
+    string(JSON name GET ${resultJson} benchmarks ${i} name)
+    string(JSON rate ERROR_VARIABLE missing GET ${resultJson} benchmarks ${i} bytes_per_second)
+    if(missing OR NOT DEFINED "baseline_${name}")
+        continue()
+    endif()
+
+    # math() is integer only: work in MB/s and tenths of a percent
+    string(REGEX REPLACE "\\..*" "" newRate ${rate})
+    string(REGEX REPLACE "\\..*" "" oldRate ${baseline_${name}})
+    math(EXPR newMB "${newRate} / 1000000")
+    math(EXPR oldMB "${oldRate} / 1000000")
+    if(oldMB EQUAL 0)
+        continue()
+    endif()
+    math(EXPR change "(${newMB} - ${oldMB}) * 1000 / ${oldMB}")
+    set(sign "+")
+    set(magnitude ${change})
+    if(change LESS 0)
+        set(sign "-")
+        math(EXPR magnitude "-${change}")
+    endif()
+    math(EXPR whole "${magnitude} / 10")
+    math(EXPR tenth "${magnitude} % 10")
+
+    set(line "${name}: ${oldMB} -> ${newMB} MB/s (${sign}${whole}.${tenth}%)")
+    math(EXPR limit "-${THRESHOLD} * 10")
+    if(change LESS limit)
+        math(EXPR regressions "${regressions} + 1")
+        message(STATUS "REGRESSION ${line}")
+    else()
+        message(STATUS "${line}")
+    endif()
+endforeach()
+
+if(regressions GREATER 0)
+    message(FATAL_ERROR "${regressions} benchmark(s) more than ${THRESHOLD}% slower than ${BASELINE}")
+endif()
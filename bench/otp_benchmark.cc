@@ -0,0 +1,202 @@
+// Throughput of the libotp kernels: encryption, decryption, text validation
+// (otpTextSpan(), the scan behind the clients' validateText()) and key
+// generation, over message sizes from 1 KiB to 1 GiB and several alphabet
+// distributions. Every benchmark reports bytes per second.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "otp.h"
+
+namespace {
+
+// Message text distributions
+enum Distribution {
+    UNIFORM, // all 27 symbols equally likely, like ciphertext
+    ENGLISH, // English letter frequencies with spaces between words
+    SINGLE,  // one repeated letter
+    DISTRIBUTION_COUNT,
+};
+
+const char *const distributionNames[DISTRIBUTION_COUNT] = { "uniform", "english", "single" };
+
+// Relative frequencies of ' ' and 'A'..'Z' in English text, per mille
+const int englishWeights[OTP_ALPHABET_SIZE] = {
+    182,
+    65, 12, 22, 34, 102, 18, 16, 50, 57, 1, 6, 33, 20,
+    57, 62, 15, 1, 49, 51, 73, 23, 8, 19, 1, 16, 1,
+};
+
+const int64_t minSize = 1 << 10;
+const int64_t maxSize = 1 << 30;
+
+char symbolAt(int index) {
+    return index == 0 ? ' ' : (char)('A' + index - 1);
+}
+
+// A 256-entry table mapping a random byte to a symbol, so text of any
+// distribution is one lookup per byte
+void buildTable(Distribution distribution, char table[256]) {
+    if (distribution == SINGLE) {
+        for (int i = 0; i < 256; i++) table[i] = 'E';
+        return;
+    }
+
+    int total = 0;
+    for (int i = 0; i < OTP_ALPHABET_SIZE; i++) {
+        total += distribution == UNIFORM ? 1 : englishWeights[i];
+    }
+    int symbol = 0;
+    int cumulative = distribution == UNIFORM ? 1 : englishWeights[0];
+    for (int i = 0; i < 256; i++) {
+        while (i * total >= cumulative * 256 && symbol < OTP_ALPHABET_SIZE - 1) {
+            symbol++;
+            cumulative += distribution == UNIFORM ? 1 : englishWeights[symbol];
+        }
+        table[i] = symbolAt(symbol);
+    }
+}
+
+// Fill text with len symbols of the distribution from a fixed seed, so runs
+// are repeatable
+void fillText(std::vector<char> &text, size_t len, Distribution distribution, uint64_t seed) {
+    char table[256];
+    buildTable(distribution, table);
+
+    text.resize(len);
+    uint64_t state = seed;
+    for (size_t i = 0; i < len; i += 8) {
+        // xorshift64*
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        uint64_t bits = state * 0x2545F4914F6CDD1DULL;
+        for (size_t j = i; j < len && j < i + 8; j++, bits >>= 8) {
+            text[j] = table[bits & 0xFF];
+        }
+    }
+}
+
+// Message and key of the benchmark being run. Google Benchmark calls a
+// benchmark several times while it settles on an iteration count, and
+// generating a gigabyte of text takes longer than ciphering it, so the text
+// is only regenerated when the arguments change. Ciphering in place turns
+// the message into uniform text; throughput doesn't care, but validation of
+// a given distribution does and asks for the original.
+struct Texts {
+    size_t len = 0;
+    int distribution = -1;
+    bool ciphered = false;
+    std::vector<char> message;
+    std::vector<char> key;
+};
+
+Texts texts;
+
+void prepareTexts(size_t len, Distribution distribution, bool original) {
+    if (texts.len == len && texts.distribution == distribution && !(original && texts.ciphered)) return;
+
+    // Let go of the previous texts first so two large sets never coexist
+    texts = Texts();
+    fillText(texts.message, len, distribution, 0x6f7470u + distribution);
+    fillText(texts.key, len, UNIFORM, 0x6b6579u);
+    texts.len = len;
+    texts.distribution = distribution;
+}
+
+void setThroughput(benchmark::State &state, size_t len) {
+    state.SetBytesProcessed((int64_t)state.iterations() * (int64_t)len);
+}
+
+// The message is ciphered in place, which keeps a 1 GiB run to two buffers.
+// The kernels run the same code whether or not the output aliases the input.
+void BM_Encrypt(benchmark::State &state) {
+    size_t len = (size_t)state.range(0);
+    Distribution distribution = (Distribution)state.range(1);
+    prepareTexts(len, distribution, false);
+    state.SetLabel(distributionNames[distribution]);
+
+    texts.ciphered = true;
+    for (auto _ : state) {
+        otpEncrypt(texts.message.data(), texts.message.data(), texts.key.data(), len);
+        benchmark::ClobberMemory();
+    }
+    setThroughput(state, len);
+}
+
+void BM_Decrypt(benchmark::State &state) {
+    size_t len = (size_t)state.range(0);
+    Distribution distribution = (Distribution)state.range(1);
+    prepareTexts(len, distribution, false);
+    state.SetLabel(distributionNames[distribution]);
+
+    texts.ciphered = true;
+    for (auto _ : state) {
+        otpDecrypt(texts.message.data(), texts.message.data(), texts.key.data(), len);
+        benchmark::ClobberMemory();
+    }
+    setThroughput(state, len);
+}
+
+void BM_ValidateText(benchmark::State &state) {
+    size_t len = (size_t)state.range(0);
+    Distribution distribution = (Distribution)state.range(1);
+    prepareTexts(len, distribution, true);
+    state.SetLabel(distributionNames[distribution]);
+
+    for (auto _ : state) {
+        size_t valid = otpTextSpan(texts.message.data(), len);
+        benchmark::DoNotOptimize(valid);
+        if (valid != len) {
+            state.SkipWithError("generated text failed validation");
+            break;
+        }
+    }
+    setThroughput(state, len);
+}
+
+// Key generation writes into the message buffer, so a 1 GiB run doesn't
+// hold a second gigabyte
+void BM_Keygen(benchmark::State &state) {
+    size_t len = (size_t)state.range(0);
+    if (texts.message.size() != len) texts = Texts();
+    texts.distribution = -1;
+    std::vector<char> &out = texts.message;
+    out.resize(len);
+
+    unsigned char seed[OTP_KEYGEN_SEED_SIZE] = { 0 };
+    struct otpKeygen gen;
+    otpKeygenInit(&gen, seed, 0);
+    for (auto _ : state) {
+        otpKeygenFill(&gen, out.data(), len);
+        benchmark::ClobberMemory();
+    }
+    setThroughput(state, len);
+}
+
+void textArgs(benchmark::internal::Benchmark *b) {
+    b->ArgNames({ "bytes", "distribution" });
+    b->ArgsProduct({ benchmark::CreateRange(minSize, maxSize, 32), { UNIFORM, ENGLISH, SINGLE } });
+    b->Unit(benchmark::kMicrosecond);
+}
+
+} // namespace
+
+BENCHMARK(BM_Encrypt)->Apply(textArgs);
+BENCHMARK(BM_Decrypt)->Apply(textArgs);
+BENCHMARK(BM_ValidateText)->Apply(textArgs);
+BENCHMARK(BM_Keygen)->ArgName("bytes")->RangeMultiplier(32)->Range(minSize, maxSize)->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char **argv) {
+    // Record which kernels ran, so baselines from different CPUs or
+    // OTP_KERNEL settings are not compared by mistake
+    benchmark::AddCustomContext("otp_kernel", otpCipherKernel());
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
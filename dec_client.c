@@ -1,14 +1,28 @@
 #include <netdb.h>      // gethostbyname()
+#include <netinet/in.h>
+#include <netinet/tcp.h>  // TCP_NODELAY
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h> // send(),recv()
 #include <sys/types.h>  // ssize_t
+#include <sys/un.h>     // sockaddr_un
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "otp_cipher.h"
+#include "otp_protocol.h"
 
 #define MAX_BUFFER_SIZE 1000
 
+// Input files are validated this many bytes at a time
+#define SCAN_WINDOW (64 * 1024 * 1024)
+
 void error(const char *msg) {
     perror(msg);
     exit(1);
@@ -20,50 +34,88 @@ void printErrorAndExit(const char *msg, int exitCode) {
 }
 
 
-char* readFile(const char* filename, size_t* out_size) {
-    FILE *fp = fopen(filename, "r");
-    if (!fp) {
-        perror("fopen");
+// Map a file read-only instead of copying it into a malloc'd buffer. The fd
+// stays open so its contents can go to the socket with sendfile().
+const char* mapFile(const char* filename, size_t* out_size, int* out_fd) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
         exit(1);
     }
 
-    fseek(fp, 0, SEEK_END);
-    long file_size = ftell(fp);
-    if (file_size < 0) {
-        perror("ftell");
-        fclose(fp);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
         exit(1);
     }
-    fseek(fp, 0, SEEK_SET);
 
-    char *buffer = malloc(file_size + 1);
-    if (!buffer) {
-        perror("malloc");
-        fclose(fp);
-        exit(1);
+    const char *text = "";
+    if (st.st_size > 0) {
+        text = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (text == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+        madvise((void *)text, st.st_size, MADV_SEQUENTIAL);
     }
 
-    size_t read_bytes = fread(buffer, 1, file_size, fp);
-    if (read_bytes != (size_t)file_size) {
-        fprintf(stderr, "Could not read entire file\n");
-        free(buffer);
-        fclose(fp);
-        exit(1);
-    }
-    buffer[read_bytes] = '\0';
+    *out_size = st.st_size;
+    *out_fd = fd;
+    return text;
+}
 
-    fclose(fp);
-    if (out_size) *out_size = read_bytes;
-    return buffer;
+// Validate the text in a mapped file, looking at no more than limit bytes
+// and stopping at a NUL as strlen() would. On success returns 1 and sets
+// *length to the length of the text; otherwise returns 0 and sets *length to
+// the offset of the first invalid byte. Validation and length come from the
+// same vectorized pass, and each window's pages are unmapped again once
+// checked so scanning a huge file doesn't grow our RSS; sendfile() later
+// reads it straight from the page cache.
+int validateText(const char *text, size_t limit, size_t *length) {
+    size_t done = 0;
+    while (done < limit) {
+        size_t window = limit - done < SCAN_WINDOW ? limit - done : SCAN_WINDOW;
+        size_t span = otpTextSpan(text + done, window);
+        done += span;
+        if (span < window && text[done] != '\0') {
+            *length = done;
+            return 0;
+        }
+        madvise((void *)(text + done - span), window, MADV_DONTNEED);
+        if (span < window) break;
+    }
+    *length = done;
+    return 1;
 }
 
+// Parse "id" or "id:offset" into job's key reference; without an offset the
+// server reserves the next unused range of the pad. Returns 1 on success,
+// 0 if it is malformed.
+int parseKeyRef(const char *ref, struct otpJob *job) {
+    char *id = strdup(ref);
+    if (!id) {
+        error("CLIENT: ERROR allocating memory");
+    }
 
-int validateText(const char *text) {
-    for (int i = 0; text[i] != '\0'; i++) {
-        if (text[i] != ' ' && text[i] != '\n' && (text[i] < 'A' || text[i] > 'Z')) {
+    uint64_t offset = OTP_KEY_OFFSET_NEXT;
+    char *colon = strchr(id, ':');
+    if (colon) {
+        *colon = '\0';
+        char *end;
+        errno = 0;
+        offset = strtoull(colon + 1, &end, 10);
+        if (errno || end == colon + 1 || *end != '\0' || colon[1] == '-') {
+            free(id);
             return 0;
         }
     }
+    if (!otpKeyIdValid(id)) {
+        free(id);
+        return 0;
+    }
+
+    job->keyId = id;
+    job->keyOffset = offset;
     return 1;
 }
 
@@ -83,143 +135,159 @@ void setupAddressStruct(struct sockaddr_in* address, int portNumber, char* hostn
            hostInfo->h_length);
 }
 
-ssize_t recvAll(int socket, char *buffer, size_t length) {
-    size_t totalReceived = 0;
-    while (totalReceived < length) {
-        ssize_t bytesReceived = recv(socket, buffer + totalReceived, length - totalReceived, 0);
-        if (bytesReceived < 0) {
-            error("SERVER: ERROR receiving data");
-        } else if (bytesReceived == 0) {
-            break; // Client closed connection
-        }
-        totalReceived += bytesReceived;
-    }
-    return totalReceived;
-}
-
-ssize_t sendAll(int socket, const char *buffer, size_t length) {
-    size_t totalSent = 0;
-    while (totalSent < length) {
-        ssize_t bytesSent = send(socket, buffer + totalSent, length - totalSent, 0);
-        if (bytesSent < 0) {
-            error("SERVER: ERROR sending data");
-        } else if (bytesSent == 0) {
-            break; // Connection closed
-        }
-        totalSent += bytesSent;
-    }
-    return totalSent;
-}
-
-
-int main(int argc, char *argv[]) {
-    int socketFD, charsWritten, charsRead;
+// Connect to the server on localhost and exchange the handshake. Exits with
+// status 2 if the server can't be reached or is the wrong kind.
+int connectToServer(const char *port) {
     struct sockaddr_in serverAddress;
-    // char ciphertextBuffer[MAX_BUFFER_SIZE];
-    // char keyBuffer[MAX_BUFFER_SIZE];
+    struct sockaddr_un unixAddress;
+    struct sockaddr *address = (struct sockaddr*)&serverAddress;
+    socklen_t addressLength = sizeof(serverAddress);
     char buffer[MAX_BUFFER_SIZE];
 
-    // Check usage & args
-    if (argc != 4) {
-        fprintf(stderr, "USAGE: %s ciphertext key port\n", argv[0]);
-        exit(1);
-    }
-
-    // Read ciphertext and key files
-    // readFileToBuffer(argv[1], ciphertextBuffer, sizeof(ciphertextBuffer));
-    // readFileToBuffer(argv[2], keyBuffer, sizeof(keyBuffer));
-
-    size_t ciphertext_len;
-    size_t keytext_len;
-
-    char *ciphertextBuffer = readFile(argv[1], &ciphertext_len);
-    char *keyBuffer = readFile(argv[2], &keytext_len);
-
-    // Validate ciphertext and key characters
-    if (!validateText(ciphertextBuffer)) {
-        fprintf(stderr, "Error: ciphertext contains invalid characters\n");
-        exit(1);
-    }
-    if (!validateText(keyBuffer)) {
-        fprintf(stderr, "Error: key contains invalid characters\n");
-        exit(1);
-    }
-
-    // Check that key is at least as long as ciphertext
-    if (strlen(keyBuffer) < strlen(ciphertextBuffer)) {
-        fprintf(stderr, "Error: key is too short\n");
-        exit(1);
-    }
+    // A "/path" or "@name" port is a Unix domain socket on this host
+    int local = otpIsUnixAddress(port);
 
     // Create a socket
-    socketFD = socket(AF_INET, SOCK_STREAM, 0);
+    int socketFD = socket(local ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
     if (socketFD < 0) {
         error("CLIENT: ERROR opening socket");
     }
 
     // Set up the server address struct
-    setupAddressStruct(&serverAddress, atoi(argv[3]), "localhost");
+    if (local) {
+        if (otpUnixAddress(port, &unixAddress, &addressLength) < 0) {
+            fprintf(stderr, "Error: socket name too long: %s\n", port);
+            exit(2);
+        }
+        address = (struct sockaddr*)&unixAddress;
+    } else {
+        setupAddressStruct(&serverAddress, atoi(port), "localhost");
+    }
 
     // Connect to server
-    if (connect(socketFD, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
-        fprintf(stderr, "Error: could not contact otp_dec_d on port %s\n", argv[3]);
+    if (connect(socketFD, address, addressLength) < 0) {
+        fprintf(stderr, "Error: could not contact otp_dec_d on port %s\n", port);
         close(socketFD);
         exit(2);
     }
 
-    // Send client ID to server and wait for confirmation
+    // Jobs are small header/response exchanges, so don't let Nagle delay them
+    if (!local) {
+        int one = 1;
+        setsockopt(socketFD, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    // Send client ID to server ("dec_client") and wait for confirmation
     memset(buffer, '\0', sizeof(buffer));
     strcpy(buffer, "dec_client");
-    charsWritten = send(socketFD, buffer, strlen(buffer), 0);
-    if (charsWritten < 0) {
+    if (send(socketFD, buffer, strlen(buffer), 0) < 0) {
         error("CLIENT: ERROR writing to socket");
     }
 
-
-
-
     // Receive server response
     memset(buffer, '\0', sizeof(buffer));
-    charsRead = recv(socketFD, buffer, sizeof(buffer) - 1, 0);
-    if (charsRead < 0) {
+    if (recv(socketFD, buffer, sizeof(buffer) - 1, 0) < 0) {
         error("CLIENT: ERROR reading from socket");
     }
 
     if (strcmp(buffer, "dec_server") != 0) {
-        fprintf(stderr, "Error: connected to wrong server type on port %s\n", argv[3]);
+        fprintf(stderr, "Error: connected to wrong server type on port %s\n", port);
         close(socketFD);
         exit(2);
     }
 
-     // Sends the expected size of the message
-    int msgSize = strlen(ciphertextBuffer);  // Get message length
+    return socketFD;
+}
+
+int main(int argc, char *argv[]) {
+    int socketFD;
 
-    charsWritten = sendAll(socketFD, (char*)&msgSize, sizeof(msgSize)); // Send as raw bytes
+    // Check usage & args
+    if (argc < 4 || argc % 2 != 0) {
+        fprintf(stderr, "USAGE: %s ciphertext key|@id[:offset] [ciphertext key ...] port\n", argv[0]);
+        exit(1);
+    }
+    const char *port = argv[argc - 1];
+
+    // Every ciphertext/key pair is one job. All jobs share one connection and
+    // their results are written to stdout in order.
+    size_t jobCount = (argc - 2) / 2;
+    struct otpJob *jobs = calloc(jobCount, sizeof(*jobs));
+    if (!jobs) {
+        error("CLIENT: ERROR allocating memory");
+    }
 
+    for (size_t i = 0; i < jobCount; i++) {
+        // Map ciphertext file
+        size_t ciphertext_size;
+        int ciphertextFD;
+        const char *ciphertextBuffer = mapFile(argv[1 + 2 * i], &ciphertext_size, &ciphertextFD);
+
+        // Validate ciphertext characters
+        size_t ciphertext_len;
+        if (!validateText(ciphertextBuffer, ciphertext_size, &ciphertext_len)) {
+            fprintf(stderr, "Error: ciphertext contains invalid characters (first at byte %zu)\n", ciphertext_len);
+            exit(1);
+        }
 
-     //send cipher text
+        jobs[i].op = OTP_OP_DECRYPT;
+        jobs[i].message = ciphertextBuffer;
+        jobs[i].len = ciphertext_len;
+        jobs[i].messageFD = ciphertextFD;
+        jobs[i].keyFD = -1;
+
+        // "@id" or "@id:offset" names a pad held by the server; nothing but
+        // the ciphertext is sent
+        const char *keyArg = argv[2 + 2 * i];
+        if (keyArg[0] == '@') {
+            if (!parseKeyRef(keyArg + 1, &jobs[i])) {
+                fprintf(stderr, "Error: bad key reference %s\n", keyArg);
+                exit(1);
+            }
+            continue;
+        }
 
-    // memset(buffer, '\0', sizeof(buffer));
-    // strcpy(buffer, ciphertextBuffer);
-    charsWritten = sendAll(socketFD, ciphertextBuffer, ciphertext_len);
+        // Map key file
+        size_t key_size;
+        int keyFD;
+        const char *keyBuffer = mapFile(keyArg, &key_size, &keyFD);
+
+        // Only the part of the key that will be used is checked, so a large
+        // pad isn't read just to cipher a short message
+        size_t keytext_len;
+        if (!validateText(keyBuffer, key_size < ciphertext_len ? key_size : ciphertext_len, &keytext_len)) {
+            fprintf(stderr, "Error: key contains invalid characters (first at byte %zu)\n", keytext_len);
+            exit(1);
+        }
 
-    // send key 
+        // Check that key is at least as long as ciphertext
+        if (keytext_len < ciphertext_len) {
+            fprintf(stderr, "Error: key is too short\n");
+            exit(1);
+        }
 
-    
-    // memset(buffer, '\0', sizeof(buffer));
-    // strcpy(buffer, keyBuffer);
-    charsWritten = sendAll(socketFD, keyBuffer, keytext_len);
+        jobs[i].key = keyBuffer;
+        jobs[i].keyFD = keyFD;
+    }
 
-    // receive ciphertext 
+    // sendfile() can't be told MSG_NOSIGNAL; a server that goes away is
+    // reported as a failed send instead
+    signal(SIGPIPE, SIG_IGN);
 
-    char *plaintext_buffer = malloc(ciphertext_len + 1);
+    socketFD = connectToServer(port);
 
-    // memset(buffer, '\0', sizeof(buffer));
-    charsRead = recvAll(socketFD, plaintext_buffer, ciphertext_len);
-    fwrite(plaintext_buffer,1,charsRead,stdout);
-    fflush(stdout);
+    // Send the requests back to back, streaming ciphertext and key chunks, and
+    // write each result as it comes back
+    int status = otpClientPipeline(socketFD, jobs, jobCount, OTP_PIPELINE_DEPTH, stdout);
+    if (status < 0) {
+        error("CLIENT: ERROR streaming message");
+    }
+    if (status != OTP_STATUS_OK) {
+        fprintf(stderr, "Error: server rejected request on port %s: %s\n", port, otpStatusString(status));
+        close(socketFD);
+        exit(2);
+    }
 
-    // printf("Buffer: \"%s\"\n", buffer);
     close(socketFD);
 
     return 0;
@@ -1,31 +1,238 @@
+#define _GNU_SOURCE // fallocate()
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <unistd.h>
+
+#include "otp_keygen.h"
+
+// Symbols generated and written per write() call
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+static int writeAll(int fd, const char *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, buffer, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer += written;
+        length -= written;
+    }
+    return 0;
+}
+
+static int pwriteAll(int fd, const char *buffer, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t written = pwrite(fd, buffer, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer += written;
+        length -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+// Write keyLength symbols and a newline to stdout
+static int generateToStdout(const unsigned char *seed, unsigned long long keyLength) {
+    struct otpKeygen gen;
+    otpKeygenInit(&gen, seed, 0);
+
+    static char buffer[OUTPUT_BUFFER_SIZE + 1];
+    while (keyLength > 0) {
+        size_t n = keyLength < OUTPUT_BUFFER_SIZE ? keyLength : OUTPUT_BUFFER_SIZE;
+        otpKeygenFill(&gen, buffer, n);
+        keyLength -= n;
+        if (keyLength == 0) buffer[n++] = '\n';
+
+        if (writeAll(STDOUT_FILENO, buffer, n) < 0) {
+            perror("write");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// One thread's share of an output file. Each region is filled from its own
+// keystream of the shared seed, so the threads never coordinate.
+struct region {
+    int fd;
+    const unsigned char *seed;
+    uint64_t stream;
+    off_t offset;
+    unsigned long long length;
+    int failed;
+};
+
+static void *fillRegion(void *arg) {
+    struct region *region = arg;
+    struct otpKeygen gen;
+    otpKeygenInit(&gen, region->seed, region->stream);
+
+    char *buffer = malloc(OUTPUT_BUFFER_SIZE);
+    if (!buffer) {
+        region->failed = ENOMEM;
+        return NULL;
+    }
+
+    off_t offset = region->offset;
+    unsigned long long left = region->length;
+    while (left > 0) {
+        size_t n = left < OUTPUT_BUFFER_SIZE ? left : OUTPUT_BUFFER_SIZE;
+        otpKeygenFill(&gen, buffer, n);
+        if (pwriteAll(region->fd, buffer, n, offset) < 0) {
+            region->failed = errno;
+            break;
+        }
+        offset += n;
+        left -= n;
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+// Write keyLength symbols and a newline to path, split across threads
+static int generateToFile(const unsigned char *seed, unsigned long long keyLength, const char *path, int threads) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    // Reserve the whole file up front so the threads' writes never extend it
+    // and a full disk is reported before any work is done
+    if (fallocate(fd, 0, 0, keyLength + 1) < 0) {
+        if (errno != EOPNOTSUPP) {
+            perror("fallocate");
+            close(fd);
+            return -1;
+        }
+        if (ftruncate(fd, keyLength + 1) < 0) {
+            perror("ftruncate");
+            close(fd);
+            return -1;
+        }
+    }
+
+    // Regions are whole output buffers, so every write but the last of each
+    // thread is a full, aligned 1 MiB
+    unsigned long long buffers = (keyLength + OUTPUT_BUFFER_SIZE - 1) / OUTPUT_BUFFER_SIZE;
+    if ((unsigned long long)threads > buffers) threads = (int)buffers;
+    unsigned long long share = (buffers + threads - 1) / threads * OUTPUT_BUFFER_SIZE;
+
+    struct region *regions = calloc(threads, sizeof(*regions));
+    pthread_t *ids = calloc(threads, sizeof(*ids));
+    if (!regions || !ids) {
+        perror("calloc");
+        close(fd);
+        return -1;
+    }
+
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        struct region *region = &regions[i];
+        region->fd = fd;
+        region->seed = seed;
+        region->stream = i;
+        region->offset = (off_t)(i * share);
+        region->length = i * share >= keyLength ? 0 : keyLength - i * share < share ? keyLength - i * share : share;
+        if (i > 0 && pthread_create(&ids[i], NULL, fillRegion, region) != 0) {
+            fprintf(stderr, "Could not start keygen thread %d\n", i);
+            region->failed = EAGAIN;
+            break;
+        }
+        started++;
+    }
+    fillRegion(&regions[0]);
+
+    int status = 0;
+    for (int i = 0; i < threads; i++) {
+        if (i > 0 && i < started) pthread_join(ids[i], NULL);
+        if (regions[i].failed) {
+            errno = regions[i].failed;
+            perror("write");
+            status = -1;
+        }
+    }
+
+    if (status == 0 && pwriteAll(fd, "\n", 1, (off_t)keyLength) < 0) {
+        perror("write");
+        status = -1;
+    }
+    if (close(fd) < 0 && status == 0) {
+        perror("close");
+        status = -1;
+    }
+
+    free(regions);
+    free(ids);
+    return status;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "USAGE: %s [--output FILE [--threads N]] keylength\n", program);
+    fprintf(stderr, "  -o, --output FILE   write the key to FILE instead of stdout\n");
+    fprintf(stderr, "  -t, --threads N     generator threads when writing to a file (default: online CPUs)\n");
+}
 
 int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        { "output", required_argument, NULL, 'o' },
+        { "threads", required_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    const char *output = NULL;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 0 ? (int)cpus : 1;
+    int threadsGiven = 0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "o:t:", options, NULL)) != -1) {
+        switch (opt) {
+        case 'o':
+            output = optarg;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            threadsGiven = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
     // Check usage
-    if (argc != 2) {
-        fprintf(stderr, "USAGE: %s keylength\n", argv[0]);
+    if (optind != argc - 1 || threads < 1 || (threadsGiven && !output)) {
+        usage(argv[0]);
         return 1;
     }
 
     // Parse key length argument
-    int keyLength = atoi(argv[1]);
-    if (keyLength <= 0) {
+    const char *lengthArg = argv[optind];
+    char *end;
+    errno = 0;
+    unsigned long long keyLength = strtoull(lengthArg, &end, 10);
+    if (errno || *end != '\0' || lengthArg[0] == '-' || keyLength == 0) {
         fprintf(stderr, "Error: keylength must be a positive integer\n");
         return 1;
     }
 
-    // Seed random number generator
-    srand((unsigned int) time(NULL));
-
-    for (int i = 0; i < keyLength; i++) {
-        int r = rand() % 27;
-        char c = (r == 26) ? ' ' : 'A' + r;
-        putchar(c);
+    // Seed the generator from the kernel's CSPRNG
+    unsigned char seed[OTP_KEYGEN_SEED_SIZE];
+    if (otpKeygenSeed(seed) < 0) {
+        perror("getrandom");
+        return 1;
     }
 
-    putchar('\n');
-
-    return 0;
+    int status = output ? generateToFile(seed, keyLength, output, threads) : generateToStdout(seed, keyLength);
+    return status < 0 ? 1 : 0;
 }
@@ -0,0 +1,23 @@
+#ifndef OTP_H
+#define OTP_H
+
+// libotp: the pieces of the otp tools that other programs can link against
+// directly instead of going through a server.
+//
+//   otp_cipher.h    encrypt/decrypt over (pointer, length) spans, into a
+//                   caller-provided buffer or in place; text validation
+//   otp_parallel.h  the same for large buffers, spread over a thread pool
+//   otp_keygen.h    pad generation from a ChaCha20 CSPRNG
+//   otp_protocol.h  the wire protocol and the client side of a connection
+//
+// The cipher, validation, parallel and keygen calls allocate nothing per
+// call, need no NUL-terminated input and keep no hold of caller memory.
+// otpClientPipeline() allocates its retry queue and buffers for results
+// that arrive out of order.
+
+#include "otp_cipher.h"
+#include "otp_keygen.h"
+#include "otp_parallel.h"
+#include "otp_protocol.h"
+
+#endif
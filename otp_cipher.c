@@ -0,0 +1,283 @@
+#include "otp_cipher.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Character to alphabet index, offset by one so that every byte outside the
+// alphabet (including '\n') maps to 0 without having to list all 256 entries.
+//   0      -> not in the alphabet
+//   1..26  -> 'A'..'Z'
+//   27     -> ' '
+static const unsigned char otpIndex[256] = {
+    ['A'] = 1,  ['B'] = 2,  ['C'] = 3,  ['D'] = 4,  ['E'] = 5,  ['F'] = 6,
+    ['G'] = 7,  ['H'] = 8,  ['I'] = 9,  ['J'] = 10, ['K'] = 11, ['L'] = 12,
+    ['M'] = 13, ['N'] = 14, ['O'] = 15, ['P'] = 16, ['Q'] = 17, ['R'] = 18,
+    ['S'] = 19, ['T'] = 20, ['U'] = 21, ['V'] = 22, ['W'] = 23, ['X'] = 24,
+    ['Y'] = 25, ['Z'] = 26, [' '] = 27
+};
+
+#define OTP_INDEX_COUNT (OTP_ALPHABET_SIZE + 1)
+
+// Alphabet symbol for a 0..26 value
+#define SYM(s) ((char)((s) == 26 ? ' ' : 'A' + (s)))
+
+// (message + key) % 27, unknown characters count as 'A'
+#define ENC_SYM(m, k) SYM((((m) ? (m) - 1 : 0) + ((k) ? (k) - 1 : 0)) % OTP_ALPHABET_SIZE)
+
+// (message - key + 27) % 27, 0 marks "copy the message byte through"
+#define DEC_SYM(m, k) ((m) && (k) ? SYM(((m) - (k) + OTP_ALPHABET_SIZE) % OTP_ALPHABET_SIZE) : 0)
+
+#define ROW(F, m) {                                                          \
+    F(m, 0),  F(m, 1),  F(m, 2),  F(m, 3),  F(m, 4),  F(m, 5),  F(m, 6),     \
+    F(m, 7),  F(m, 8),  F(m, 9),  F(m, 10), F(m, 11), F(m, 12), F(m, 13),    \
+    F(m, 14), F(m, 15), F(m, 16), F(m, 17), F(m, 18), F(m, 19), F(m, 20),    \
+    F(m, 21), F(m, 22), F(m, 23), F(m, 24), F(m, 25), F(m, 26), F(m, 27)     \
+}
+
+#define TABLE(F) {                                                           \
+    ROW(F, 0),  ROW(F, 1),  ROW(F, 2),  ROW(F, 3),  ROW(F, 4),  ROW(F, 5),   \
+    ROW(F, 6),  ROW(F, 7),  ROW(F, 8),  ROW(F, 9),  ROW(F, 10), ROW(F, 11),  \
+    ROW(F, 12), ROW(F, 13), ROW(F, 14), ROW(F, 15), ROW(F, 16), ROW(F, 17),  \
+    ROW(F, 18), ROW(F, 19), ROW(F, 20), ROW(F, 21), ROW(F, 22), ROW(F, 23),  \
+    ROW(F, 24), ROW(F, 25), ROW(F, 26), ROW(F, 27)                           \
+}
+
+static const char otpEncTable[OTP_INDEX_COUNT][OTP_INDEX_COUNT] = TABLE(ENC_SYM);
+static const char otpDecTable[OTP_INDEX_COUNT][OTP_INDEX_COUNT] = TABLE(DEC_SYM);
+
+static void otpEncryptScalar(char *out, const char *message, const char *key, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char m = (unsigned char)message[i];
+        char c = otpEncTable[otpIndex[m]][otpIndex[(unsigned char)key[i]]];
+        out[i] = (m == '\n') ? '\n' : c; // Preserve newline
+    }
+}
+
+static void otpDecryptScalar(char *out, const char *message, const char *key, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char m = message[i];
+        char c = otpDecTable[otpIndex[(unsigned char)m]][otpIndex[(unsigned char)key[i]]];
+        out[i] = c ? c : m;
+    }
+}
+
+static size_t otpTextSpanScalar(const char *text, size_t len) {
+    size_t i = 0;
+    while (i < len && (otpIndex[(unsigned char)text[i]] || text[i] == '\n')) i++;
+    return i;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define OTP_HAVE_X86_SIMD 1
+
+// The vector kernels map 'A'..'Z' to 0..25 and ' ' to 26, then add or subtract
+// with a compare-and-subtract of 27 done as an unsigned min:
+//   encrypt: s = m + k      -> min(s, s - 27) wraps s - 27 above 228 when s < 27
+//   decrypt: d = m - k      -> min(d, d + 27) picks d + 27 only when d wrapped
+// Lanes holding a message newline are blended back unchanged. A block with
+// any other byte outside the alphabet is handed to the scalar kernel so the
+// output matches it exactly. Both return the number of bytes processed.
+
+__attribute__((target("sse4.1")))
+static size_t otpCryptSse41(char *out, const char *message, const char *key, size_t len, int decrypt) {
+    const __m128i letterA = _mm_set1_epi8('A');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i max25 = _mm_set1_epi8(25);
+    const __m128i sym26 = _mm_set1_epi8(26);
+    const __m128i mod27 = _mm_set1_epi8(27);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i m = _mm_loadu_si128((const __m128i *)(message + i));
+        __m128i k = _mm_loadu_si128((const __m128i *)(key + i));
+
+        __m128i mLetter = _mm_sub_epi8(m, letterA);
+        __m128i kLetter = _mm_sub_epi8(k, letterA);
+        __m128i mSpace = _mm_cmpeq_epi8(m, space);
+        __m128i kSpace = _mm_cmpeq_epi8(k, space);
+        __m128i mNewline = _mm_cmpeq_epi8(m, newline);
+        __m128i mValid = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(mLetter, max25), mLetter), mSpace);
+        __m128i kValid = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(kLetter, max25), kLetter), kSpace);
+        __m128i ok = _mm_or_si128(_mm_and_si128(mValid, kValid), mNewline);
+        if (_mm_movemask_epi8(ok) != 0xFFFF) {
+            if (decrypt)
+                otpDecryptScalar(out + i, message + i, key + i, 16);
+            else
+                otpEncryptScalar(out + i, message + i, key + i, 16);
+            continue;
+        }
+
+        __m128i mi = _mm_blendv_epi8(mLetter, sym26, mSpace);
+        __m128i ki = _mm_blendv_epi8(kLetter, sym26, kSpace);
+        __m128i r;
+        if (decrypt) {
+            r = _mm_sub_epi8(mi, ki);
+            r = _mm_min_epu8(r, _mm_add_epi8(r, mod27));
+        } else {
+            r = _mm_add_epi8(mi, ki);
+            r = _mm_min_epu8(r, _mm_sub_epi8(r, mod27));
+        }
+        __m128i c = _mm_blendv_epi8(_mm_add_epi8(r, letterA), space, _mm_cmpeq_epi8(r, sym26));
+        c = _mm_blendv_epi8(c, newline, mNewline);
+        _mm_storeu_si128((__m128i *)(out + i), c);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t otpCryptAvx2(char *out, const char *message, const char *key, size_t len, int decrypt) {
+    const __m256i letterA = _mm256_set1_epi8('A');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i max25 = _mm256_set1_epi8(25);
+    const __m256i sym26 = _mm256_set1_epi8(26);
+    const __m256i mod27 = _mm256_set1_epi8(27);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i m = _mm256_loadu_si256((const __m256i *)(message + i));
+        __m256i k = _mm256_loadu_si256((const __m256i *)(key + i));
+
+        __m256i mLetter = _mm256_sub_epi8(m, letterA);
+        __m256i kLetter = _mm256_sub_epi8(k, letterA);
+        __m256i mSpace = _mm256_cmpeq_epi8(m, space);
+        __m256i kSpace = _mm256_cmpeq_epi8(k, space);
+        __m256i mNewline = _mm256_cmpeq_epi8(m, newline);
+        __m256i mValid = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(mLetter, max25), mLetter), mSpace);
+        __m256i kValid = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(kLetter, max25), kLetter), kSpace);
+        __m256i ok = _mm256_or_si256(_mm256_and_si256(mValid, kValid), mNewline);
+        if (_mm256_movemask_epi8(ok) != -1) {
+            if (decrypt)
+                otpDecryptScalar(out + i, message + i, key + i, 32);
+            else
+                otpEncryptScalar(out + i, message + i, key + i, 32);
+            continue;
+        }
+
+        __m256i mi = _mm256_blendv_epi8(mLetter, sym26, mSpace);
+        __m256i ki = _mm256_blendv_epi8(kLetter, sym26, kSpace);
+        __m256i r;
+        if (decrypt) {
+            r = _mm256_sub_epi8(mi, ki);
+            r = _mm256_min_epu8(r, _mm256_add_epi8(r, mod27));
+        } else {
+            r = _mm256_add_epi8(mi, ki);
+            r = _mm256_min_epu8(r, _mm256_sub_epi8(r, mod27));
+        }
+        __m256i c = _mm256_blendv_epi8(_mm256_add_epi8(r, letterA), space, _mm256_cmpeq_epi8(r, sym26));
+        c = _mm256_blendv_epi8(c, newline, mNewline);
+        _mm256_storeu_si256((__m256i *)(out + i), c);
+    }
+    return i;
+}
+
+// The span kernels check a block at a time and stop at the first block with
+// a byte outside the alphabet, returning that byte's offset, or the number
+// of bytes in whole blocks if there is none
+
+__attribute__((target("sse4.1")))
+static size_t otpTextSpanSse41(const char *text, size_t len) {
+    const __m128i letterA = _mm_set1_epi8('A');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i max25 = _mm_set1_epi8(25);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i t = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i letter = _mm_sub_epi8(t, letterA);
+        __m128i ok = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(letter, max25), letter),
+                                  _mm_or_si128(_mm_cmpeq_epi8(t, space), _mm_cmpeq_epi8(t, newline)));
+        unsigned bad = ~(unsigned)_mm_movemask_epi8(ok) & 0xFFFF;
+        if (bad) return i + __builtin_ctz(bad);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t otpTextSpanAvx2(const char *text, size_t len) {
+    const __m256i letterA = _mm256_set1_epi8('A');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i max25 = _mm256_set1_epi8(25);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i t = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i letter = _mm256_sub_epi8(t, letterA);
+        __m256i ok = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(letter, max25), letter),
+                                     _mm256_or_si256(_mm256_cmpeq_epi8(t, space), _mm256_cmpeq_epi8(t, newline)));
+        unsigned bad = ~(unsigned)_mm256_movemask_epi8(ok);
+        if (bad) return i + __builtin_ctz(bad);
+    }
+    return i;
+}
+#endif
+
+typedef size_t (*otpVectorFn)(char *out, const char *message, const char *key, size_t len, int decrypt);
+typedef size_t (*otpSpanFn)(const char *text, size_t len);
+
+static otpVectorFn otpVectorKernel;
+static otpSpanFn otpSpanKernel;
+static const char *otpKernelName;
+
+// Pick the widest kernel the CPU supports, once at startup.
+// OTP_KERNEL=scalar|sse4.1|avx2 in the environment caps the choice, which is
+// handy when comparing kernels.
+__attribute__((constructor))
+static void otpSelectKernel(void) {
+    const char *limit = getenv("OTP_KERNEL");
+    otpVectorFn kernel = NULL;
+    otpSpanFn span = NULL;
+    const char *name = "scalar";
+
+#ifdef OTP_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    int allowAvx2 = !limit || strcmp(limit, "avx2") == 0;
+    int allowSse41 = allowAvx2 || strcmp(limit, "sse4.1") == 0;
+    if (allowAvx2 && __builtin_cpu_supports("avx2")) {
+        kernel = otpCryptAvx2;
+        span = otpTextSpanAvx2;
+        name = "avx2";
+    } else if (allowSse41 && __builtin_cpu_supports("sse4.1")) {
+        kernel = otpCryptSse41;
+        span = otpTextSpanSse41;
+        name = "sse4.1";
+    }
+#else
+    (void)limit;
+#endif
+
+    otpVectorKernel = kernel;
+    otpSpanKernel = span;
+    otpKernelName = name;
+}
+
+const char *otpCipherKernel(void) {
+    return otpKernelName;
+}
+
+void otpEncrypt(char *out, const char *message, const char *key, size_t len) {
+    size_t done = otpVectorKernel ? otpVectorKernel(out, message, key, len, 0) : 0;
+    otpEncryptScalar(out + done, message + done, key + done, len - done);
+}
+
+void otpDecrypt(char *out, const char *message, const char *key, size_t len) {
+    size_t done = otpVectorKernel ? otpVectorKernel(out, message, key, len, 1) : 0;
+    otpDecryptScalar(out + done, message + done, key + done, len - done);
+}
+
+void otpEncryptInPlace(char *text, const char *key, size_t len) {
+    otpEncrypt(text, text, key, len);
+}
+
+void otpDecryptInPlace(char *text, const char *key, size_t len) {
+    otpDecrypt(text, text, key, len);
+}
+
+size_t otpTextSpan(const char *text, size_t len) {
+    size_t done = otpSpanKernel ? otpSpanKernel(text, len) : 0;
+    return done + otpTextSpanScalar(text + done, len - done);
+}
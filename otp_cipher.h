@@ -0,0 +1,45 @@
+#ifndef OTP_CIPHER_H
+#define OTP_CIPHER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of symbols in the pad alphabet: 'A'..'Z' followed by ' '
+#define OTP_ALPHABET_SIZE 27
+
+// Signature shared by otpEncrypt() and otpDecrypt()
+typedef void (*otpCipherFn)(char *out, const char *message, const char *key, size_t len);
+
+// Encrypt len bytes of message with key into out.
+// Newlines in the message are passed through unchanged, any other character
+// outside the alphabet is treated as 'A'. out may alias message.
+void otpEncrypt(char *out, const char *message, const char *key, size_t len);
+
+// Decrypt len bytes of message with key into out.
+// Newlines and characters outside the alphabet (in either the message or the
+// key) copy the message byte through unchanged. out may alias message.
+void otpDecrypt(char *out, const char *message, const char *key, size_t len);
+
+// Encrypt or decrypt len bytes of text in place
+void otpEncryptInPlace(char *text, const char *key, size_t len);
+void otpDecryptInPlace(char *text, const char *key, size_t len);
+
+// Length of the initial run of text that is in the message alphabet
+// ('A'..'Z', ' ' and '\n'), looking at no more than len bytes. Validation and
+// length in one pass: the text is valid up to a NUL terminator when the
+// result is len or text[result] is '\0', and otherwise the result is the
+// offset of the first invalid byte.
+size_t otpTextSpan(const char *text, size_t len);
+
+// Name of the kernel picked for this CPU ("avx2", "sse4.1" or "scalar").
+// The choice is made once, on first use.
+const char *otpCipherKernel(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "otp_protocol.h"
+#include "otp_server.h"
+
+// One daemon for both operations: the client's handshake and each request
+// header pick what is done, over one worker pool and one set of pads
+int main(int argc, char* argv[]) {
+    struct otpServerConfig config = {
+        .ops = OTP_OPS_ALL,
+    };
+
+    if (otpParseServerArgs(argc, argv, &config) < 0) {
+        exit(1);
+    }
+
+    otpServe(&config);
+    return 1;
+}
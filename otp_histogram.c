@@ -0,0 +1,95 @@
+#include "otp_histogram.h"
+
+#include <string.h>
+
+#define HALF (OTP_HISTOGRAM_SUB_BUCKETS / 2)
+#define LARGEST ((UINT64_C(1) << OTP_HISTOGRAM_MAX_BITS) - 1)
+
+// Only the recording thread writes, so plain loads and stores suffice; they
+// are atomic so concurrent readers see whole values
+static uint64_t load(const uint64_t *field) {
+    return __atomic_load_n(field, __ATOMIC_RELAXED);
+}
+
+static void store(uint64_t *field, uint64_t value) {
+    __atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+// Values below OTP_HISTOGRAM_SUB_BUCKETS get a bucket each. Above, each
+// power of two [2^e, 2^(e+1)) is split into HALF buckets of width
+// 2^(e - SUB_BITS + 1), so every bucket is under 1/HALF of its values wide.
+static size_t indexOf(uint64_t value) {
+    if (value < OTP_HISTOGRAM_SUB_BUCKETS) return (size_t)value;
+    if (value > LARGEST) value = LARGEST;
+
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - OTP_HISTOGRAM_SUB_BITS + 1;
+    size_t sub = (size_t)(value >> shift) - HALF;
+    return OTP_HISTOGRAM_SUB_BUCKETS + (size_t)(exponent - OTP_HISTOGRAM_SUB_BITS) * HALF + sub;
+}
+
+// The largest value that lands in bucket index
+static uint64_t highestOf(size_t index) {
+    if (index < OTP_HISTOGRAM_SUB_BUCKETS) return index;
+
+    size_t above = index - OTP_HISTOGRAM_SUB_BUCKETS;
+    int shift = (int)(above / HALF) + 1;
+    uint64_t sub = HALF + above % HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+void otpHistogramInit(struct otpHistogram *histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->min = UINT64_MAX;
+}
+
+void otpHistogramRecord(struct otpHistogram *histogram, uint64_t value) {
+    uint64_t *count = &histogram->counts[indexOf(value)];
+    store(count, load(count) + 1);
+    store(&histogram->total, load(&histogram->total) + 1);
+    store(&histogram->sum, load(&histogram->sum) + value);
+    if (value < load(&histogram->min)) store(&histogram->min, value);
+    if (value > load(&histogram->max)) store(&histogram->max, value);
+}
+
+void otpHistogramMerge(struct otpHistogram *into, const struct otpHistogram *from) {
+    for (size_t i = 0; i < OTP_HISTOGRAM_BUCKETS; i++) {
+        into->counts[i] += load(&from->counts[i]);
+    }
+    into->total += load(&from->total);
+    into->sum += load(&from->sum);
+    uint64_t min = load(&from->min);
+    uint64_t max = load(&from->max);
+    if (min < into->min) into->min = min;
+    if (max > into->max) into->max = max;
+}
+
+uint64_t otpHistogramCountAtOrBelow(const struct otpHistogram *histogram, uint64_t value) {
+    size_t last = indexOf(value);
+    uint64_t count = 0;
+    for (size_t i = 0; i <= last; i++) {
+        count += load(&histogram->counts[i]);
+    }
+    return count;
+}
+
+uint64_t otpHistogramPercentile(const struct otpHistogram *histogram, double percentile) {
+    uint64_t total = load(&histogram->total);
+    uint64_t max = load(&histogram->max);
+    if (total == 0) return 0;
+    if (percentile >= 100) return max;
+
+    // Rank of the value wanted, counting from 1
+    uint64_t rank = (uint64_t)(percentile / 100 * total + 0.5);
+    if (rank < 1) rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < OTP_HISTOGRAM_BUCKETS; i++) {
+        seen += load(&histogram->counts[i]);
+        if (seen >= rank) {
+            uint64_t value = highestOf(i);
+            return value < max ? value : max;
+        }
+    }
+    return max;
+}
@@ -0,0 +1,42 @@
+#ifndef OTP_HISTOGRAM_H
+#define OTP_HISTOGRAM_H
+
+#include <stdint.h>
+
+// High dynamic range histogram of latencies in nanoseconds, in the style of
+// HdrHistogram: values are exact below OTP_HISTOGRAM_SUB_BUCKETS and kept to
+// three significant digits (within 0.1%) above, up to 2^OTP_HISTOGRAM_MAX_BITS
+// ns, about 73 minutes. Larger values are recorded as the largest. The
+// struct is fixed size and holds no pointers, so it can be copied or placed
+// in shared memory as is. One thread or process may record into a histogram
+// while others read it: every field is loaded and stored atomically, though
+// a reader can see a recording only partly applied.
+#define OTP_HISTOGRAM_SUB_BITS 11
+#define OTP_HISTOGRAM_SUB_BUCKETS (1 << OTP_HISTOGRAM_SUB_BITS)
+#define OTP_HISTOGRAM_MAX_BITS 42
+#define OTP_HISTOGRAM_BUCKETS \
+    (OTP_HISTOGRAM_SUB_BUCKETS + (OTP_HISTOGRAM_MAX_BITS - OTP_HISTOGRAM_SUB_BITS) * (OTP_HISTOGRAM_SUB_BUCKETS / 2))
+
+struct otpHistogram {
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t counts[OTP_HISTOGRAM_BUCKETS];
+};
+
+void otpHistogramInit(struct otpHistogram *histogram);
+void otpHistogramRecord(struct otpHistogram *histogram, uint64_t value);
+
+// Add every value recorded in from to into
+void otpHistogramMerge(struct otpHistogram *into, const struct otpHistogram *from);
+
+// Number of recorded values at or below value, counting every value in
+// value's bucket
+uint64_t otpHistogramCountAtOrBelow(const struct otpHistogram *histogram, uint64_t value);
+
+// The value below which percentile percent of the recorded values fall,
+// rounded up to the top of its bucket. 0 if nothing was recorded.
+uint64_t otpHistogramPercentile(const struct otpHistogram *histogram, double percentile);
+
+#endif
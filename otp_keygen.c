@@ -0,0 +1,205 @@
+#include "otp_keygen.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include "otp_cipher.h"
+
+// Random byte to pad symbol, or 0 to reject the byte. Only bytes below 243,
+// the largest multiple of 27 that fits in a byte, are kept, so that b % 27
+// is uniform over the alphabet.
+static char otpKeygenSymbol[256];
+
+#define ROTL(v, n) ((v) << (n) | (v) >> (32 - (n)))
+
+#define QUARTER(a, b, c, d)                  \
+    a += b; d ^= a; d = ROTL(d, 16);         \
+    c += d; b ^= c; b = ROTL(b, 12);         \
+    a += b; d ^= a; d = ROTL(d, 8);          \
+    c += d; b ^= c; b = ROTL(b, 7)
+
+static uint32_t load32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void store32(unsigned char *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+// Block counter, words 12 and 13 of the state
+static uint64_t otpKeygenCounter(const struct otpKeygen *gen) {
+    return (uint64_t)gen->state[13] << 32 | gen->state[12];
+}
+
+static void otpKeygenAdvance(struct otpKeygen *gen, uint64_t blocks) {
+    uint64_t counter = otpKeygenCounter(gen) + blocks;
+    gen->state[12] = (uint32_t)counter;
+    gen->state[13] = (uint32_t)(counter >> 32);
+}
+
+// Fill gen->block with the next OTP_KEYGEN_BLOCKS ChaCha20 blocks
+static void otpKeygenBlocksScalar(struct otpKeygen *gen) {
+    for (int n = 0; n < OTP_KEYGEN_BLOCKS; n++) {
+        uint32_t x[16];
+        for (int i = 0; i < 16; i++) x[i] = gen->state[i];
+
+        for (int round = 0; round < 20; round += 2) {
+            QUARTER(x[0], x[4], x[8], x[12]);
+            QUARTER(x[1], x[5], x[9], x[13]);
+            QUARTER(x[2], x[6], x[10], x[14]);
+            QUARTER(x[3], x[7], x[11], x[15]);
+            QUARTER(x[0], x[5], x[10], x[15]);
+            QUARTER(x[1], x[6], x[11], x[12]);
+            QUARTER(x[2], x[7], x[8], x[13]);
+            QUARTER(x[3], x[4], x[9], x[14]);
+        }
+
+        for (int i = 0; i < 16; i++) store32(gen->block + 64 * n + 4 * i, x[i] + gen->state[i]);
+        otpKeygenAdvance(gen, 1);
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define OTP_HAVE_X86_SIMD 1
+
+#define ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define QUARTER256(a, b, c, d)                                                      \
+    a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16); \
+    c = _mm256_add_epi32(c, d); b = ROTL256(_mm256_xor_si256(b, c), 12);            \
+    a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8);  \
+    c = _mm256_add_epi32(c, d); b = ROTL256(_mm256_xor_si256(b, c), 7)
+
+// Eight blocks at once, one per 32-bit lane: vector i holds word i of every
+// block. The words are transposed back on the way out so the keystream is
+// the same as the scalar kernel's.
+__attribute__((target("avx2")))
+static void otpKeygenBlocksAvx2(struct otpKeygen *gen) {
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+
+    uint64_t counter = otpKeygenCounter(gen);
+    uint32_t low[8], high[8];
+    for (int n = 0; n < 8; n++) {
+        low[n] = (uint32_t)(counter + n);
+        high[n] = (uint32_t)((counter + n) >> 32);
+    }
+
+    __m256i in[16], x[16];
+    for (int i = 0; i < 16; i++) in[i] = _mm256_set1_epi32((int)gen->state[i]);
+    in[12] = _mm256_loadu_si256((const __m256i *)low);
+    in[13] = _mm256_loadu_si256((const __m256i *)high);
+    for (int i = 0; i < 16; i++) x[i] = in[i];
+
+    for (int round = 0; round < 20; round += 2) {
+        QUARTER256(x[0], x[4], x[8], x[12]);
+        QUARTER256(x[1], x[5], x[9], x[13]);
+        QUARTER256(x[2], x[6], x[10], x[14]);
+        QUARTER256(x[3], x[7], x[11], x[15]);
+        QUARTER256(x[0], x[5], x[10], x[15]);
+        QUARTER256(x[1], x[6], x[11], x[12]);
+        QUARTER256(x[2], x[7], x[8], x[13]);
+        QUARTER256(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++) x[i] = _mm256_add_epi32(x[i], in[i]);
+
+    // Transpose each half (words 0..7, then 8..15) from word-major to
+    // block-major order
+    for (int half = 0; half < 2; half++) {
+        const __m256i *a = x + 8 * half;
+        __m256i t0 = _mm256_unpacklo_epi32(a[0], a[1]), t1 = _mm256_unpackhi_epi32(a[0], a[1]);
+        __m256i t2 = _mm256_unpacklo_epi32(a[2], a[3]), t3 = _mm256_unpackhi_epi32(a[2], a[3]);
+        __m256i t4 = _mm256_unpacklo_epi32(a[4], a[5]), t5 = _mm256_unpackhi_epi32(a[4], a[5]);
+        __m256i t6 = _mm256_unpacklo_epi32(a[6], a[7]), t7 = _mm256_unpackhi_epi32(a[6], a[7]);
+        __m256i u[8] = {
+            _mm256_unpacklo_epi64(t0, t2), _mm256_unpackhi_epi64(t0, t2),
+            _mm256_unpacklo_epi64(t1, t3), _mm256_unpackhi_epi64(t1, t3),
+            _mm256_unpacklo_epi64(t4, t6), _mm256_unpackhi_epi64(t4, t6),
+            _mm256_unpacklo_epi64(t5, t7), _mm256_unpackhi_epi64(t5, t7),
+        };
+        for (int n = 0; n < 4; n++) {
+            unsigned char *out = gen->block + 64 * n + 32 * half;
+            _mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(u[n], u[n + 4], 0x20));
+            _mm256_storeu_si256((__m256i *)(out + 256), _mm256_permute2x128_si256(u[n], u[n + 4], 0x31));
+        }
+    }
+
+    otpKeygenAdvance(gen, 8);
+}
+#endif
+
+static void (*otpKeygenBlocks)(struct otpKeygen *gen) = otpKeygenBlocksScalar;
+
+// Build the symbol table and pick the block kernel, once at startup.
+// OTP_KERNEL=scalar keeps the scalar kernel, as it does for the cipher.
+__attribute__((constructor))
+static void otpKeygenSetup(void) {
+    static const char alphabet[OTP_ALPHABET_SIZE] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ ";
+    for (int b = 0; b < 256 / OTP_ALPHABET_SIZE * OTP_ALPHABET_SIZE; b++) {
+        otpKeygenSymbol[b] = alphabet[b % OTP_ALPHABET_SIZE];
+    }
+
+#ifdef OTP_HAVE_X86_SIMD
+    const char *limit = getenv("OTP_KERNEL");
+    __builtin_cpu_init();
+    if ((!limit || strcmp(limit, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        otpKeygenBlocks = otpKeygenBlocksAvx2;
+    }
+#endif
+}
+
+int otpKeygenSeed(unsigned char *seed) {
+    size_t got = 0;
+    while (got < OTP_KEYGEN_SEED_SIZE) {
+        ssize_t n = getrandom(seed + got, OTP_KEYGEN_SEED_SIZE - got, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        got += n;
+    }
+    return 0;
+}
+
+void otpKeygenInit(struct otpKeygen *gen, const unsigned char *seed, uint64_t stream) {
+    // "expand 32-byte k", the key, a 64-bit block counter and a 64-bit nonce
+    gen->state[0] = 0x61707865;
+    gen->state[1] = 0x3320646e;
+    gen->state[2] = 0x79622d32;
+    gen->state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) gen->state[4 + i] = load32(seed + 4 * i);
+    gen->state[12] = 0;
+    gen->state[13] = 0;
+    gen->state[14] = (uint32_t)stream;
+    gen->state[15] = (uint32_t)(stream >> 32);
+    gen->used = sizeof(gen->block);
+}
+
+void otpKeygenFill(struct otpKeygen *gen, char *out, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        if (gen->used == sizeof(gen->block)) {
+            otpKeygenBlocks(gen);
+            gen->used = 0;
+        }
+
+        // Every byte is stored, and kept by advancing i only when it is not
+        // rejected, which avoids a hard to predict branch per byte
+        const unsigned char *b = gen->block;
+        size_t j = gen->used;
+        for (; j < sizeof(gen->block) && i < len; j++) {
+            char symbol = otpKeygenSymbol[b[j]];
+            out[i] = symbol;
+            i += symbol != 0;
+        }
+        gen->used = j;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef OTP_KEYGEN_H
+#define OTP_KEYGEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bytes of seed a generator is keyed with
+#define OTP_KEYGEN_SEED_SIZE 32
+
+// ChaCha20 blocks generated at a time
+#define OTP_KEYGEN_BLOCKS 8
+
+// Pad generator: a ChaCha20 keystream turned into symbols of the pad alphabet
+// by rejection sampling, so every symbol is equally likely
+struct otpKeygen {
+    uint32_t state[16];
+    unsigned char block[64 * OTP_KEYGEN_BLOCKS];
+    size_t used;
+};
+
+// Fill seed with OTP_KEYGEN_SEED_SIZE bytes from getrandom().
+// Returns 0 on success, -1 with errno set on failure.
+int otpKeygenSeed(unsigned char *seed);
+
+// Start keystream number stream for seed. Different streams of one seed are
+// independent, so several generators can share a seed.
+void otpKeygenInit(struct otpKeygen *gen, const unsigned char *seed, uint64_t stream);
+
+// Write len pad symbols ('A'..'Z' and ' ') to out
+void otpKeygenFill(struct otpKeygen *gen, char *out, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
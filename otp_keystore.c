@@ -0,0 +1,186 @@
+#include "otp_keystore.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Size of a ledger file and its mapping
+#define LEDGER_SIZE 4096
+
+// Loaded keys, sorted by id for otpKeyStoreFind()
+static struct otpKey *keys;
+static size_t keyCount;
+
+static int compareKeys(const void *a, const void *b) {
+    return strcmp(((const struct otpKey *)a)->id, ((const struct otpKey *)b)->id);
+}
+
+// Map one pad file into key. Returns 0 on success, -1 after printing an error.
+static int mapKey(int dirFD, const char *name, struct otpKey *key) {
+    int fd = openat(dirFD, name, O_RDONLY);
+    if (fd < 0) {
+        perror(name);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(name);
+        close(fd);
+        return -1;
+    }
+
+    key->data = "";
+    key->len = st.st_size;
+    if (st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            perror(name);
+            close(fd);
+            return -1;
+        }
+        key->data = data;
+        if (key->data[key->len - 1] == '\n') key->len--;
+    }
+    close(fd);
+    return 0;
+}
+
+// Open or create <id>.ledger for key and map it shared. Returns 0 on
+// success, -1 after printing an error.
+static int mapLedger(int dirFD, struct otpKey *key) {
+    char name[OTP_KEY_ID_SIZE + sizeof(".ledger")];
+    snprintf(name, sizeof(name), "%s.ledger", key->id);
+
+    int created = 1;
+    int fd = openat(dirFD, name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = 0;
+        fd = openat(dirFD, name, O_RDWR);
+    }
+    if (fd < 0) {
+        perror(name);
+        return -1;
+    }
+
+    // A new ledger is all zeroes: nothing used yet
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (st.st_size < LEDGER_SIZE && ftruncate(fd, LEDGER_SIZE) < 0)) {
+        perror(name);
+        close(fd);
+        return -1;
+    }
+
+    // A new ledger's directory entry must reach the disk too, or a crash
+    // could lose the file along with every range reserved in it
+    if (created && (fsync(fd) < 0 || fsync(dirFD) < 0)) {
+        perror(name);
+        close(fd);
+        return -1;
+    }
+
+    void *ledger = mmap(NULL, LEDGER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ledger == MAP_FAILED) {
+        perror(name);
+        return -1;
+    }
+    key->next = ledger;
+    return 0;
+}
+
+static int syncLedger(const struct otpKey *key) {
+    if (msync(key->next, LEDGER_SIZE, MS_SYNC) < 0) {
+        perror("SERVER: ERROR syncing key ledger");
+        return -1;
+    }
+    return 0;
+}
+
+int otpKeyStoreOpen(const char *dir, int ledgers) {
+    DIR *listing = opendir(dir);
+    if (!listing) {
+        perror(dir);
+        return -1;
+    }
+
+    size_t capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(listing)) != NULL) {
+        size_t nameLen = strlen(entry->d_name);
+        if (nameLen <= 4 || strcmp(entry->d_name + nameLen - 4, ".key") != 0) continue;
+
+        char id[OTP_KEY_ID_SIZE + 1];
+        size_t idLen = nameLen - 4;
+        if (idLen > OTP_KEY_ID_SIZE) {
+            fprintf(stderr, "SERVER: Skipping key %s: id is longer than %d characters\n", entry->d_name, OTP_KEY_ID_SIZE);
+            continue;
+        }
+        memcpy(id, entry->d_name, idLen);
+        id[idLen] = '\0';
+        if (!otpKeyIdValid(id)) {
+            fprintf(stderr, "SERVER: Skipping key %s: invalid id\n", entry->d_name);
+            continue;
+        }
+
+        if (keyCount == capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            struct otpKey *grown = realloc(keys, capacity * sizeof(*keys));
+            if (!grown) {
+                perror("realloc");
+                closedir(listing);
+                return -1;
+            }
+            keys = grown;
+        }
+
+        struct otpKey *key = &keys[keyCount];
+        strcpy(key->id, id);
+        key->next = NULL;
+        if (mapKey(dirfd(listing), entry->d_name, key) < 0 || (ledgers && mapLedger(dirfd(listing), key) < 0)) {
+            closedir(listing);
+            return -1;
+        }
+        keyCount++;
+    }
+    closedir(listing);
+
+    qsort(keys, keyCount, sizeof(*keys), compareKeys);
+    return (int)keyCount;
+}
+
+const struct otpKey *otpKeyStoreFind(const char *id) {
+    struct otpKey probe;
+    strncpy(probe.id, id, sizeof(probe.id) - 1);
+    probe.id[sizeof(probe.id) - 1] = '\0';
+    if (keyCount == 0) return NULL;
+    return bsearch(&probe, keys, keyCount, sizeof(*keys), compareKeys);
+}
+
+int otpKeyReserve(const struct otpKey *key, uint64_t len, uint64_t *offset) {
+    uint64_t next = __atomic_load_n(key->next, __ATOMIC_ACQUIRE);
+    do {
+        if (next > key->len || len > key->len - next) return 1;
+    } while (!__atomic_compare_exchange_n(key->next, &next, next + len, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    // The range must be on disk before any output made with it leaves
+    if (syncLedger(key) < 0) return -1;
+    *offset = next;
+    return 0;
+}
+
+int otpKeyReserveAt(const struct otpKey *key, uint64_t offset, uint64_t len) {
+    uint64_t next = __atomic_load_n(key->next, __ATOMIC_ACQUIRE);
+    do {
+        if (offset < next) return 1;
+    } while (!__atomic_compare_exchange_n(key->next, &next, offset + len, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    if (syncLedger(key) < 0) return -1;
+    return 0;
+}
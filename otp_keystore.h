@@ -0,0 +1,47 @@
+#ifndef OTP_KEYSTORE_H
+#define OTP_KEYSTORE_H
+
+#include <stdint.h>
+
+#include "otp_protocol.h"
+
+// A pad the server holds: the file <id>.key in the key directory, mapped
+// read-only. len excludes the trailing newline keygen writes.
+//
+// Next to each pad, <id>.ledger records how much of it encryption has used:
+// a page whose first 8 bytes hold the next unused offset in host byte
+// order. It is mapped shared by every worker, updated with atomic
+// instructions, and synced to disk before a reserved range is used, so no
+// range is handed out twice, even across a crash or restart.
+struct otpKey {
+    char id[OTP_KEY_ID_SIZE + 1];
+    const char *data;
+    uint64_t len;
+    uint64_t *next; // in the ledger mapping, or NULL without ledgers
+};
+
+// Map every <id>.key file in dir, and with ledgers set, each key's ledger,
+// creating it if need be. Only a server that encrypts needs the ledgers; one
+// that only decrypts leaves them alone and can run on a read-only key
+// directory. Call before forking so the workers share the mappings. Returns
+// the number of keys loaded, or -1 after printing an error.
+int otpKeyStoreOpen(const char *dir, int ledgers);
+
+// The key called id, or NULL if there is none
+const struct otpKey *otpKeyStoreFind(const char *id);
+
+// Reserve the next len unused bytes of key and make the reservation durable.
+// This and otpKeyReserveAt() need the store opened with ledgers.
+// Returns 0 and sets *offset to the start of the range, 1 if the pad does
+// not have len bytes left, or -1 if the ledger could not be synced.
+int otpKeyReserve(const struct otpKey *key, uint64_t len, uint64_t *offset);
+
+// Reserve the len bytes of key at offset, which must lie within the pad,
+// and make the reservation durable. Only ranges past every earlier
+// reservation can be had; the ledger then moves past this one, and any
+// bytes skipped before offset are never used. Returns 0, 1 if offset is
+// below the ledger's next unused offset, or -1 if the ledger could not be
+// synced.
+int otpKeyReserveAt(const struct otpKey *key, uint64_t offset, uint64_t len);
+
+#endif
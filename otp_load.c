@@ -0,0 +1,702 @@
+#define _GNU_SOURCE // clock_nanosleep() with TIMER_ABSTIME
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "otp_histogram.h"
+#include "otp_keygen.h"
+#include "otp_protocol.h"
+
+// Load generator for enc_server, dec_server and otp_d. Each connection has a
+// sender thread issuing requests and a receiver thread reading the answers,
+// so requests can be pipelined and a slow response never delays the next
+// send. In closed loop a connection keeps --window requests in flight and
+// sends the next as soon as one finishes. In open loop requests start on a
+// Poisson schedule at --rate per second whatever the server's progress, and
+// latency is measured from when a request was due rather than when it could
+// be sent, so a stalled server shows up in the tail instead of hiding it.
+
+// Most requests one connection tracks in flight; an open-loop sender that
+// gets this far ahead of the server waits
+#define MAX_IN_FLIGHT 4096
+
+// Chunk pairs sent per sendmsg()
+#define SEND_CHUNKS 32
+
+// Seconds to wait after the run for requests still in flight
+#define DRAIN_SECONDS 5
+
+#define NS_PER_SEC 1000000000LL
+
+// Message sizes: one size, a uniform range, or weighted choices
+struct sizeSpec {
+    size_t count;
+    size_t sizes[64];
+    double weights[64]; // cumulative, the last one 1
+    int range;          // sizes[0]..sizes[1] uniformly
+};
+
+struct loadConfig {
+    const char *address;
+    const char *host;
+    int op;
+    int connections;
+    int window;       // closed loop requests in flight per connection
+    double rate;      // open loop requests per second in total, 0 for closed loop
+    double duration;  // seconds recorded
+    double warmup;    // seconds run before recording
+    unsigned long reuse; // requests per connection before reconnecting, 0 for never
+    size_t maxMessage; // the server's --max-message, 0 for none
+    struct sizeSpec sizes;
+};
+
+struct loadConnection {
+    int index;
+    int fd;
+    uint64_t rng;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int inFlight;
+    int done;     // the sender has stopped
+    int failed;   // the connection broke; both threads stop
+    uint32_t nextJob;
+    int64_t start[MAX_IN_FLIGHT]; // when each job in flight was due, by jobId
+    size_t len[MAX_IN_FLIGHT];
+
+    // Filled in by the receiver
+    struct otpHistogram latency;
+    uint64_t completed;
+    uint64_t bytes;
+    uint64_t busy;    // requests the server turned away as busy
+    uint64_t errors;
+    int finished;
+};
+
+static struct loadConfig config;
+static char *messageText;
+static char *keyText;
+static int64_t recordFrom;
+static int64_t recordUntil;
+
+static int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void sleepUntil(int64_t when) {
+    struct timespec ts = { .tv_sec = when / NS_PER_SEC, .tv_nsec = when % NS_PER_SEC };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+
+    }
+}
+
+// xorshift64*, one generator per connection
+static uint64_t nextRandom(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double randomUnit(uint64_t *state) {
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static size_t pickSize(uint64_t *state) {
+    const struct sizeSpec *spec = &config.sizes;
+    if (spec->range) {
+        return spec->sizes[0] + nextRandom(state) % (spec->sizes[1] - spec->sizes[0] + 1);
+    }
+    double pick = randomUnit(state);
+    for (size_t i = 0; i < spec->count - 1; i++) {
+        if (pick < spec->weights[i]) return spec->sizes[i];
+    }
+    return spec->sizes[spec->count - 1];
+}
+
+static int sendAll(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t sent = send(fd, p, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+static int recvAll(int fd, void *data, size_t len) {
+    char *p = data;
+    while (len > 0) {
+        ssize_t got = recv(fd, p, len, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return -1;
+        p += got;
+        len -= got;
+    }
+    return 0;
+}
+
+// Connect and exchange the handshake for config.op. Returns the socket or -1.
+static int connectServer(void) {
+    const char *client = config.op == OTP_OP_ENCRYPT ? "enc_client" : "dec_client";
+    const char *server = config.op == OTP_OP_ENCRYPT ? "enc_server" : "dec_server";
+
+    int fd;
+    int local = otpIsUnixAddress(config.address);
+    if (local) {
+        struct sockaddr_un address;
+        socklen_t addressLength;
+        if (otpUnixAddress(config.address, &address, &addressLength) < 0) return -1;
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (struct sockaddr *)&address, addressLength) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+        struct addrinfo *addresses;
+        if (getaddrinfo(config.host, config.address, &hints, &addresses) != 0) return -1;
+        fd = -1;
+        for (struct addrinfo *a = addresses; a; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (fd < 0) continue;
+            if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(addresses);
+        if (fd < 0) return -1;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    char reply[OTP_HANDSHAKE_SIZE];
+    if (sendAll(fd, client, OTP_HANDSHAKE_SIZE) < 0 || recvAll(fd, reply, sizeof(reply)) < 0 ||
+        memcmp(reply, server, OTP_HANDSHAKE_SIZE) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Send one request: the header, then message and key chunks interleaved
+static int sendRequest(int fd, uint32_t jobId, size_t len) {
+    struct otpRequest request = {
+        .magic = OTP_MAGIC,
+        .version = OTP_VERSION,
+        .op = config.op,
+        .jobId = jobId,
+        .msgLen = len,
+        .keyLen = len,
+    };
+    unsigned char header[OTP_REQUEST_SIZE];
+    otpPackRequest(header, &request);
+    if (sendAll(fd, header, sizeof(header)) < 0) return -1;
+
+    // Position in the stream of chunk pairs: the pair for message offset o
+    // starts at 2 * o, message bytes first
+    size_t total = 2 * len;
+    size_t done = 0;
+    while (done < total) {
+        struct iovec iov[2 * SEND_CHUNKS];
+        int count = 0;
+        for (size_t at = done; at < total && count < 2 * SEND_CHUNKS;) {
+            size_t offset = at / (2 * OTP_CHUNK_SIZE) * OTP_CHUNK_SIZE;
+            size_t n = len - offset < OTP_CHUNK_SIZE ? len - offset : OTP_CHUNK_SIZE;
+            size_t within = at - 2 * offset;
+            if (within < n) {
+                iov[count].iov_base = messageText + offset + within;
+                iov[count++].iov_len = n - within;
+                at = 2 * offset + n;
+            } else {
+                iov[count].iov_base = keyText + offset + within - n;
+                iov[count++].iov_len = 2 * n - within;
+                at = 2 * offset + 2 * n;
+            }
+        }
+
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += sent;
+    }
+    return 0;
+}
+
+static void failConnection(struct loadConnection *conn, const char *why) {
+    pthread_mutex_lock(&conn->lock);
+    if (!conn->failed) {
+        fprintf(stderr, "otp_load: connection %d: %s\n", conn->index, why);
+        conn->failed = 1;
+        conn->errors++;
+    }
+    pthread_cond_broadcast(&conn->changed);
+    pthread_mutex_unlock(&conn->lock);
+}
+
+static void *senderMain(void *arg) {
+    struct loadConnection *conn = arg;
+    double perConnectionRate = config.rate / config.connections;
+    int64_t due = now();
+    unsigned long onConnection = 0;
+
+    while (1) {
+        if (config.rate > 0) {
+            // Exponential gaps between requests give Poisson arrivals
+            due += (int64_t)(-log(1.0 - randomUnit(&conn->rng)) / perConnectionRate * NS_PER_SEC);
+            if (due >= recordUntil) break;
+            sleepUntil(due);
+        } else if (now() >= recordUntil) {
+            break;
+        }
+
+        int window = config.rate > 0 ? MAX_IN_FLIGHT : config.window;
+        pthread_mutex_lock(&conn->lock);
+        while (conn->inFlight >= window && !conn->failed) {
+            pthread_cond_wait(&conn->changed, &conn->lock);
+        }
+        int64_t start = config.rate > 0 ? due : now();
+
+        // Reconnect once the connection has carried its share, after its
+        // answers are in. In closed loop the new connection's setup counts
+        // towards the first request on it.
+        if (config.reuse && onConnection == config.reuse) {
+            while (conn->inFlight > 0 && !conn->failed) {
+                pthread_cond_wait(&conn->changed, &conn->lock);
+            }
+            if (!conn->failed) {
+                close(conn->fd);
+                conn->fd = -1;
+                onConnection = 0;
+            }
+        }
+        if (conn->failed) {
+            pthread_mutex_unlock(&conn->lock);
+            break;
+        }
+        pthread_mutex_unlock(&conn->lock);
+
+        if (conn->fd < 0) {
+            int fd = connectServer();
+            if (fd < 0) {
+                failConnection(conn, "could not connect");
+                break;
+            }
+            pthread_mutex_lock(&conn->lock);
+            conn->fd = fd;
+            pthread_mutex_unlock(&conn->lock);
+        }
+
+        size_t len = pickSize(&conn->rng);
+        pthread_mutex_lock(&conn->lock);
+        uint32_t jobId = conn->nextJob++;
+        conn->start[jobId % MAX_IN_FLIGHT] = start;
+        conn->len[jobId % MAX_IN_FLIGHT] = len;
+        conn->inFlight++;
+        pthread_cond_broadcast(&conn->changed);
+        pthread_mutex_unlock(&conn->lock);
+
+        if (sendRequest(conn->fd, jobId, len) < 0) {
+            failConnection(conn, "send failed");
+            break;
+        }
+        onConnection++;
+    }
+
+    pthread_mutex_lock(&conn->lock);
+    conn->done = 1;
+    pthread_cond_broadcast(&conn->changed);
+    pthread_mutex_unlock(&conn->lock);
+    return NULL;
+}
+
+static void *receiverMain(void *arg) {
+    struct loadConnection *conn = arg;
+    size_t discardSize = 256 * 1024;
+    char *discard = malloc(discardSize);
+    if (!discard) {
+        failConnection(conn, "out of memory");
+        discardSize = 0;
+    }
+
+    while (1) {
+        pthread_mutex_lock(&conn->lock);
+        while (conn->inFlight == 0 && !conn->done && !conn->failed) {
+            pthread_cond_wait(&conn->changed, &conn->lock);
+        }
+        if (conn->failed || conn->inFlight == 0) {
+            pthread_mutex_unlock(&conn->lock);
+            break;
+        }
+        int fd = conn->fd;
+        pthread_mutex_unlock(&conn->lock);
+
+        unsigned char wire[OTP_RESPONSE_SIZE];
+        struct otpResponse response;
+        if (recvAll(fd, wire, sizeof(wire)) < 0) {
+            failConnection(conn, "connection closed");
+            break;
+        }
+        otpUnpackResponse(wire, &response);
+
+        // A busy server drops the request but keeps the connection; count
+        // it as shed load rather than retrying, so the run shows how much
+        // the server turned away
+        if (response.magic == OTP_MAGIC && response.status == OTP_STATUS_BUSY) {
+            pthread_mutex_lock(&conn->lock);
+            int64_t start = conn->start[response.jobId % MAX_IN_FLIGHT];
+            if (start >= recordFrom && start < recordUntil) conn->busy++;
+            conn->inFlight--;
+            pthread_cond_broadcast(&conn->changed);
+            pthread_mutex_unlock(&conn->lock);
+            continue;
+        }
+        if (response.magic != OTP_MAGIC || response.status != OTP_STATUS_OK) {
+            // The server closes after rejecting a request
+            failConnection(conn, response.magic != OTP_MAGIC ? "bad response" : otpStatusString(response.status));
+            break;
+        }
+
+        uint64_t left = response.msgLen;
+        while (left > 0) {
+            size_t n = left < discardSize ? left : discardSize;
+            ssize_t got = recv(fd, discard, n, 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) break;
+            left -= got;
+        }
+        if (left > 0) {
+            failConnection(conn, "connection closed mid-response");
+            break;
+        }
+
+        int64_t end = now();
+        pthread_mutex_lock(&conn->lock);
+        int64_t start = conn->start[response.jobId % MAX_IN_FLIGHT];
+        if (start >= recordFrom && start < recordUntil) {
+            otpHistogramRecord(&conn->latency, end - start);
+            conn->completed++;
+            conn->bytes += conn->len[response.jobId % MAX_IN_FLIGHT];
+        }
+        conn->inFlight--;
+        pthread_cond_broadcast(&conn->changed);
+        pthread_mutex_unlock(&conn->lock);
+    }
+
+    free(discard);
+    pthread_mutex_lock(&conn->lock);
+    conn->finished = 1;
+    pthread_mutex_unlock(&conn->lock);
+    return NULL;
+}
+
+// Parse a size with an optional K, M or G (binary) suffix. Returns 0 on
+// error, including a size too large for size_t.
+static size_t parseSize(const char *text, char **end) {
+    errno = 0;
+    unsigned long long value = strtoull(text, end, 10);
+    if (errno || *end == text || text[0] == '-') return 0;
+    int shift = 0;
+    switch (**end) {
+    case 'K': case 'k': shift = 10; (*end)++; break;
+    case 'M': case 'm': shift = 20; (*end)++; break;
+    case 'G': case 'g': shift = 30; (*end)++; break;
+    }
+    if (value > SIZE_MAX >> shift) return 0;
+    return (size_t)value << shift;
+}
+
+// "N", "MIN-MAX" or "N@W,N@W,..." with the weights optional (default 1)
+static int parseSizeSpec(const char *text, struct sizeSpec *spec) {
+    memset(spec, 0, sizeof(*spec));
+    char *end;
+    size_t first = parseSize(text, &end);
+    if (!first) return -1;
+
+    if (*end == '-') {
+        size_t last = parseSize(end + 1, &end);
+        if (!last || *end || last < first) return -1;
+        spec->sizes[0] = first;
+        spec->sizes[1] = last;
+        spec->count = 2;
+        spec->range = 1;
+        return 0;
+    }
+
+    double total = 0;
+    const char *p = text;
+    while (1) {
+        if (spec->count == sizeof(spec->sizes) / sizeof(spec->sizes[0])) return -1;
+        size_t size = parseSize(p, &end);
+        if (!size) return -1;
+        double weight = 1;
+        if (*end == '@') {
+            char *after;
+            weight = strtod(end + 1, &after);
+            if (after == end + 1 || weight <= 0) return -1;
+            end = after;
+        }
+        spec->sizes[spec->count] = size;
+        total += weight;
+        spec->weights[spec->count++] = total;
+        if (*end == '\0') break;
+        if (*end != ',') return -1;
+        p = end + 1;
+    }
+    for (size_t i = 0; i < spec->count; i++) spec->weights[i] /= total;
+    return 0;
+}
+
+static size_t largestSize(const struct sizeSpec *spec) {
+    size_t largest = 0;
+    for (size_t i = 0; i < spec->count; i++) {
+        if (spec->sizes[i] > largest) largest = spec->sizes[i];
+    }
+    return largest;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "USAGE: %s [options] port|/path|@name\n", program);
+    fprintf(stderr, "  -c, --connections N  concurrent connections (default: 1)\n");
+    fprintf(stderr, "  -d, --duration S     seconds to record (default: 10)\n");
+    fprintf(stderr, "      --warmup S       seconds to run before recording (default: 1)\n");
+    fprintf(stderr, "  -s, --size SPEC      message bytes: N, MIN-MAX, or N@WEIGHT,... with K/M/G suffixes (default: 1K)\n");
+    fprintf(stderr, "  -r, --rate R         open loop: start R requests/s in total (default: closed loop)\n");
+    fprintf(stderr, "  -w, --window N       closed loop: requests in flight per connection (default: 1)\n");
+    fprintf(stderr, "  -n, --reuse N        requests per connection before reconnecting (default: 0, never)\n");
+    fprintf(stderr, "  -o, --op OP          encrypt or decrypt (default: encrypt)\n");
+    fprintf(stderr, "  -H, --host HOST      server host for a TCP port (default: localhost)\n");
+    fprintf(stderr, "  -M, --max-message N  the server's --max-message: reject larger sizes up front\n");
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        { "connections", required_argument, NULL, 'c' },
+        { "duration", required_argument, NULL, 'd' },
+        { "warmup", required_argument, NULL, 'W' },
+        { "size", required_argument, NULL, 's' },
+        { "rate", required_argument, NULL, 'r' },
+        { "window", required_argument, NULL, 'w' },
+        { "reuse", required_argument, NULL, 'n' },
+        { "op", required_argument, NULL, 'o' },
+        { "host", required_argument, NULL, 'H' },
+        { "max-message", required_argument, NULL, 'M' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    config.host = "localhost";
+    config.op = OTP_OP_ENCRYPT;
+    config.connections = 1;
+    config.window = 1;
+    config.duration = 10;
+    config.warmup = 1;
+    parseSizeSpec("1K", &config.sizes);
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:d:s:r:w:n:o:H:M:", options, NULL)) != -1) {
+        switch (opt) {
+        case 'c':
+            config.connections = atoi(optarg);
+            break;
+        case 'd':
+            config.duration = atof(optarg);
+            break;
+        case 'W':
+            config.warmup = atof(optarg);
+            break;
+        case 's':
+            if (parseSizeSpec(optarg, &config.sizes) < 0) {
+                fprintf(stderr, "otp_load: bad size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            config.rate = atof(optarg);
+            break;
+        case 'w':
+            config.window = atoi(optarg);
+            break;
+        case 'n':
+            config.reuse = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            if (strcmp(optarg, "encrypt") == 0) {
+                config.op = OTP_OP_ENCRYPT;
+            } else if (strcmp(optarg, "decrypt") == 0) {
+                config.op = OTP_OP_DECRYPT;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'H':
+            config.host = optarg;
+            break;
+        case 'M': {
+            char *end;
+            config.maxMessage = parseSize(optarg, &end);
+            if (!config.maxMessage || *end) {
+                fprintf(stderr, "otp_load: bad size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1 || config.connections < 1 || config.window < 1 || config.window > MAX_IN_FLIGHT ||
+        config.duration <= 0 || config.warmup < 0 || config.rate < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    config.address = argv[optind];
+
+    // Every request would come back too large, so say so before sending any
+    if (config.maxMessage && largestSize(&config.sizes) > config.maxMessage) {
+        fprintf(stderr, "otp_load: sizes up to %zu bytes exceed --max-message %zu\n", largestSize(&config.sizes),
+                config.maxMessage);
+        return 1;
+    }
+
+    // One message and one key long enough for the largest request; every
+    // request sends a prefix of them
+    size_t largest = largestSize(&config.sizes);
+    unsigned char seed[OTP_KEYGEN_SEED_SIZE];
+    struct otpKeygen gen;
+    messageText = malloc(largest);
+    keyText = malloc(largest);
+    if (!messageText || !keyText || otpKeygenSeed(seed) < 0) {
+        fprintf(stderr, "otp_load: could not set up %zu byte messages\n", largest);
+        return 1;
+    }
+    otpKeygenInit(&gen, seed, 0);
+    otpKeygenFill(&gen, messageText, largest);
+    otpKeygenFill(&gen, keyText, largest);
+
+    struct loadConnection *conns = calloc(config.connections, sizeof(*conns));
+    if (!conns) {
+        perror("calloc");
+        return 1;
+    }
+
+    // Connect everything before the clock starts
+    for (int i = 0; i < config.connections; i++) {
+        struct loadConnection *conn = &conns[i];
+        conn->index = i;
+        conn->rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+        pthread_mutex_init(&conn->lock, NULL);
+        pthread_cond_init(&conn->changed, NULL);
+        otpHistogramInit(&conn->latency);
+        conn->fd = connectServer();
+        if (conn->fd < 0) {
+            fprintf(stderr, "otp_load: could not connect to %s\n", config.address);
+            return 2;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    int64_t begin = now();
+    recordFrom = begin + (int64_t)(config.warmup * NS_PER_SEC);
+    recordUntil = recordFrom + (int64_t)(config.duration * NS_PER_SEC);
+
+    pthread_t *threads = malloc(2 * config.connections * sizeof(*threads));
+    if (!threads) {
+        perror("malloc");
+        return 1;
+    }
+    for (int i = 0; i < config.connections; i++) {
+        if (pthread_create(&threads[2 * i], NULL, senderMain, &conns[i]) != 0 ||
+            pthread_create(&threads[2 * i + 1], NULL, receiverMain, &conns[i]) != 0) {
+            fprintf(stderr, "otp_load: could not start threads\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < config.connections; i++) {
+        pthread_join(threads[2 * i], NULL);
+    }
+
+    // Give requests still in flight a while to finish; whatever is left
+    // after that is reported as unfinished
+    int64_t drainUntil = now() + DRAIN_SECONDS * NS_PER_SEC;
+    uint64_t unfinished = 0;
+    for (int i = 0; i < config.connections; i++) {
+        struct loadConnection *conn = &conns[i];
+        while (1) {
+            pthread_mutex_lock(&conn->lock);
+            int finished = conn->finished;
+            int inFlight = conn->inFlight;
+            pthread_mutex_unlock(&conn->lock);
+            if (finished) break;
+            if (now() >= drainUntil) {
+                unfinished += inFlight;
+                break;
+            }
+            sleepUntil(now() + NS_PER_SEC / 100);
+        }
+    }
+
+    struct otpHistogram *latency = malloc(sizeof(*latency));
+    if (!latency) {
+        perror("malloc");
+        return 1;
+    }
+    otpHistogramInit(latency);
+    uint64_t completed = 0, bytes = 0, busy = 0, errors = 0;
+    for (int i = 0; i < config.connections; i++) {
+        struct loadConnection *conn = &conns[i];
+        pthread_mutex_lock(&conn->lock);
+        otpHistogramMerge(latency, &conn->latency);
+        completed += conn->completed;
+        bytes += conn->bytes;
+        busy += conn->busy;
+        errors += conn->errors;
+        pthread_mutex_unlock(&conn->lock);
+    }
+
+    if (config.rate > 0) {
+        printf("open loop: %.0f requests/s over %d connection(s)\n", config.rate, config.connections);
+    } else {
+        printf("closed loop: %d connection(s), %d in flight each\n", config.connections, config.window);
+    }
+    printf("recorded %.1f s after %.1f s warmup: %llu requests, %llu busy, %llu errors, %llu unfinished\n",
+           config.duration, config.warmup, (unsigned long long)completed, (unsigned long long)busy,
+           (unsigned long long)errors, (unsigned long long)unfinished);
+    printf("throughput: %.1f requests/s, %.2f MB/s\n", completed / config.duration, bytes / config.duration / 1e6);
+    if (completed > 0) {
+        printf("latency us: p50 %.1f  p99 %.1f  p999 %.1f  max %.1f  mean %.1f\n",
+               otpHistogramPercentile(latency, 50) / 1e3, otpHistogramPercentile(latency, 99) / 1e3,
+               otpHistogramPercentile(latency, 99.9) / 1e3, latency->max / 1e3,
+               (double)latency->sum / latency->total / 1e3);
+    }
+    fflush(stdout);
+
+    // Receivers still waiting on a stuck server are left behind
+    _exit(errors > 0 || unfinished > 0 ? 2 : 0);
+}
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE // open_memstream()
+#include "otp_metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "otp_histogram.h"
+#include "otp_protocol.h"
+
+// Room for every status code, including ones added later
+#define STATUS_SLOTS 16
+
+struct workerMetrics {
+    uint64_t counters[OTP_COUNTER_COUNT];
+    uint64_t rejects[STATUS_SLOTS];
+    struct otpHistogram stages[OTP_STAGE_COUNT];
+};
+
+static struct workerMetrics *slots;
+static int slotCount;
+static struct workerMetrics *mine;
+
+static const struct {
+    const char *name;
+    const char *help;
+} counterInfo[OTP_COUNTER_COUNT] = {
+    { "otp_connections_accepted_total", "Connections accepted" },
+    { "otp_connections_closed_total", "Connections closed" },
+    { "otp_requests_total", "Request headers received" },
+    { "otp_jobs_completed_total", "Jobs whose output was all sent" },
+    { "otp_received_bytes_total", "Bytes read from clients" },
+    { "otp_sent_bytes_total", "Bytes written to clients" },
+};
+
+static const char *const stageNames[OTP_STAGE_COUNT] = {
+    "accept_wait", "handshake", "header", "receive", "cipher", "send", "job",
+};
+
+// Label values for rejection statuses, by status code
+static const char *const statusNames[STATUS_SLOTS] = {
+    [OTP_STATUS_BAD_MAGIC] = "bad_magic",
+    [OTP_STATUS_BAD_VERSION] = "bad_version",
+    [OTP_STATUS_BAD_OP] = "bad_op",
+    [OTP_STATUS_UNSUPPORTED] = "unsupported",
+    [OTP_STATUS_KEY_TOO_SHORT] = "key_too_short",
+    [OTP_STATUS_NO_SUCH_KEY] = "no_such_key",
+    [OTP_STATUS_BAD_KEY_REF] = "bad_key_ref",
+    [OTP_STATUS_BUSY] = "busy",
+    [OTP_STATUS_TOO_LARGE] = "too_large",
+};
+
+// Histogram bucket bounds in nanoseconds: 1, 2.5 and 5 times each power of
+// ten from 1 us to 10 s
+static const uint64_t bucketBounds[] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000, 250000000, 500000000,
+    1000000000, 2500000000, 5000000000, 10000000000,
+};
+
+// Each slot has a single writer, so an update needs no read-modify-write
+static void bump(uint64_t *field, uint64_t n) {
+    __atomic_store_n(field, __atomic_load_n(field, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+int otpMetricsInit(int workers) {
+    size_t size = (size_t)workers * sizeof(struct workerMetrics);
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        perror("ERROR mapping metrics");
+        return -1;
+    }
+
+    slots = region;
+    slotCount = workers;
+    for (int i = 0; i < workers; i++) {
+        for (int stage = 0; stage < OTP_STAGE_COUNT; stage++) {
+            otpHistogramInit(&slots[i].stages[stage]);
+        }
+    }
+    return 0;
+}
+
+void otpMetricsSelect(int worker) {
+    if (slots && worker >= 0 && worker < slotCount) mine = &slots[worker];
+}
+
+void otpMetricsAdd(enum otpCounter counter, uint64_t n) {
+    if (mine) bump(&mine->counters[counter], n);
+}
+
+void otpMetricsReject(int status) {
+    if (mine && status >= 0 && status < STATUS_SLOTS) bump(&mine->rejects[status], 1);
+}
+
+void otpMetricsRecord(enum otpStage stage, uint64_t ns) {
+    if (mine) otpHistogramRecord(&mine->stages[stage], ns);
+}
+
+uint64_t otpMetricsNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t loadField(const uint64_t *field) {
+    return __atomic_load_n(field, __ATOMIC_RELAXED);
+}
+
+char *otpMetricsText(size_t *len) {
+    char *text = NULL;
+    FILE *out = open_memstream(&text, len);
+    if (!out) return NULL;
+
+    for (int counter = 0; counter < OTP_COUNTER_COUNT; counter++) {
+        fprintf(out, "# HELP %s %s.\n# TYPE %s counter\n", counterInfo[counter].name, counterInfo[counter].help,
+                counterInfo[counter].name);
+        for (int i = 0; i < slotCount; i++) {
+            fprintf(out, "%s{worker=\"%d\"} %llu\n", counterInfo[counter].name, i,
+                    (unsigned long long)loadField(&slots[i].counters[counter]));
+        }
+    }
+
+    fprintf(out, "# HELP otp_rejects_total Requests rejected, by status.\n# TYPE otp_rejects_total counter\n");
+    for (int i = 0; i < slotCount; i++) {
+        for (int status = 0; status < STATUS_SLOTS; status++) {
+            if (!statusNames[status]) continue;
+            fprintf(out, "otp_rejects_total{worker=\"%d\",status=\"%s\"} %llu\n", i, statusNames[status],
+                    (unsigned long long)loadField(&slots[i].rejects[status]));
+        }
+    }
+
+    // Stage histograms are merged across workers first; one copy is plenty
+    struct otpHistogram *merged = malloc(sizeof(*merged));
+    if (!merged) {
+        fclose(out);
+        free(text);
+        return NULL;
+    }
+    fprintf(out, "# HELP otp_stage_duration_seconds Time spent in each stage of serving connections and jobs.\n"
+                 "# TYPE otp_stage_duration_seconds histogram\n");
+    for (int stage = 0; stage < OTP_STAGE_COUNT; stage++) {
+        otpHistogramInit(merged);
+        for (int i = 0; i < slotCount; i++) {
+            otpHistogramMerge(merged, &slots[i].stages[stage]);
+        }
+
+        // The workers keep recording while this runs; counting the buckets
+        // themselves keeps the total consistent with them
+        uint64_t total = otpHistogramCountAtOrBelow(merged, UINT64_MAX);
+        const char *name = stageNames[stage];
+        for (size_t b = 0; b < sizeof(bucketBounds) / sizeof(bucketBounds[0]); b++) {
+            fprintf(out, "otp_stage_duration_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n", name,
+                    bucketBounds[b] / 1e9, (unsigned long long)otpHistogramCountAtOrBelow(merged, bucketBounds[b]));
+        }
+        fprintf(out, "otp_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", name,
+                (unsigned long long)total);
+        fprintf(out, "otp_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n", name, merged->sum / 1e9);
+        fprintf(out, "otp_stage_duration_seconds_count{stage=\"%s\"} %llu\n", name, (unsigned long long)total);
+    }
+    free(merged);
+
+    if (fclose(out) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
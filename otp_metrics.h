@@ -0,0 +1,55 @@
+#ifndef OTP_METRICS_H
+#define OTP_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Server metrics. Every worker process owns one slot of a shared mapping set
+// up before the workers are forked and is the only writer of it, so
+// updating a metric is a plain atomic load and store with no locking. The
+// parent reads all slots to answer scrapes. Until otpMetricsInit() and
+// otpMetricsSelect() have run the update functions do nothing.
+
+enum otpCounter {
+    OTP_COUNTER_ACCEPTED,  // connections accepted
+    OTP_COUNTER_CLOSED,    // connections closed
+    OTP_COUNTER_REQUESTS,  // request headers received
+    OTP_COUNTER_JOBS,      // jobs whose output was all sent
+    OTP_COUNTER_BYTES_IN,  // bytes read from clients
+    OTP_COUNTER_BYTES_OUT, // bytes written to clients
+    OTP_COUNTER_COUNT,
+};
+
+// Latency stages, each a histogram in nanoseconds. A job's receive, cipher
+// and send stages are its totals over all of its batches.
+enum otpStage {
+    OTP_STAGE_ACCEPT_WAIT, // the worker waking to a connection being accepted
+    OTP_STAGE_HANDSHAKE,   // accept to handshake received
+    OTP_STAGE_HEADER,      // first header byte to the request being answered
+    OTP_STAGE_RECEIVE,     // waiting for payload batches to arrive
+    OTP_STAGE_CIPHER,      // ciphering payload batches
+    OTP_STAGE_SEND,        // handing ciphered batches to the kernel
+    OTP_STAGE_JOB,         // first header byte to the last output byte sent
+    OTP_STAGE_COUNT,
+};
+
+// Map slots for workers worker processes. Call once, before forking.
+// Returns 0, or -1 after printing why.
+int otpMetricsInit(int workers);
+
+// Make this process write to slot worker
+void otpMetricsSelect(int worker);
+
+void otpMetricsAdd(enum otpCounter counter, uint64_t n);
+void otpMetricsReject(int status);
+void otpMetricsRecord(enum otpStage stage, uint64_t ns);
+
+// Monotonic clock in nanoseconds, for stage timings
+uint64_t otpMetricsNow(void);
+
+// All metrics in the Prometheus text exposition format: counters per
+// worker, stage histograms summed over workers. Returns a malloc()ed string
+// the caller frees and sets *len, or returns NULL.
+char *otpMetricsText(size_t *len);
+
+#endif
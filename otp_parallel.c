@@ -0,0 +1,122 @@
+#include "otp_parallel.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+// A batch is published by bumping generation under the lock. Threads then
+// claim tasks with an atomic counter, so handing out work never blocks, and
+// the caller sleeps until every helper has finished with the batch.
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t workDone = PTHREAD_COND_INITIALIZER;
+
+static int poolThreads = 1;
+static unsigned long generation;
+static int helpersBusy;
+
+// A batch is either a list of tasks or, with batchTasks NULL, the one span
+// batchSpan cut into OTP_PARALLEL_RANGE ranges as they are claimed
+static otpCipherFn batchCipher;
+static const struct otpParallelTask *batchTasks;
+static struct otpParallelTask batchSpan;
+static size_t batchCount;
+static size_t nextTask;
+
+static void runTasks(void) {
+    while (1) {
+        size_t i = __atomic_fetch_add(&nextTask, 1, __ATOMIC_RELAXED);
+        if (i >= batchCount) return;
+        if (batchTasks) {
+            const struct otpParallelTask *task = &batchTasks[i];
+            batchCipher(task->out, task->message, task->key, task->len);
+        } else {
+            size_t offset = i * OTP_PARALLEL_RANGE;
+            size_t len = batchSpan.len - offset < OTP_PARALLEL_RANGE ? batchSpan.len - offset : OTP_PARALLEL_RANGE;
+            batchCipher(batchSpan.out + offset, batchSpan.message + offset, batchSpan.key + offset, len);
+        }
+    }
+}
+
+static void *helperMain(void *arg) {
+    (void)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&poolLock);
+    while (1) {
+        while (generation == seen) {
+            pthread_cond_wait(&workReady, &poolLock);
+        }
+        seen = generation;
+        pthread_mutex_unlock(&poolLock);
+
+        runTasks();
+
+        pthread_mutex_lock(&poolLock);
+        if (--helpersBusy == 0) pthread_cond_signal(&workDone);
+    }
+    return NULL;
+}
+
+int otpParallelInit(int threads) {
+    for (int i = 1; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, helperMain, NULL) != 0) {
+            fprintf(stderr, "Could not start cipher thread %d\n", i);
+            return -1;
+        }
+        pthread_detach(thread);
+        poolThreads++;
+    }
+    return 0;
+}
+
+int otpParallelThreads(void) {
+    return poolThreads;
+}
+
+// Hand a batch of count tasks to the helpers, work on it too and wait for
+// all of it to be done
+static void runBatch(otpCipherFn cipher, const struct otpParallelTask *tasks, size_t count) {
+    pthread_mutex_lock(&poolLock);
+    batchCipher = cipher;
+    batchTasks = tasks;
+    batchCount = count;
+    nextTask = 0;
+    helpersBusy = poolThreads - 1;
+    generation++;
+    pthread_cond_broadcast(&workReady);
+    pthread_mutex_unlock(&poolLock);
+
+    runTasks();
+
+    pthread_mutex_lock(&poolLock);
+    while (helpersBusy > 0) {
+        pthread_cond_wait(&workDone, &poolLock);
+    }
+    pthread_mutex_unlock(&poolLock);
+}
+
+void otpParallelRun(otpCipherFn cipher, const struct otpParallelTask *tasks, size_t count) {
+    if (poolThreads == 1 || count < 2) {
+        for (size_t i = 0; i < count; i++) {
+            cipher(tasks[i].out, tasks[i].message, tasks[i].key, tasks[i].len);
+        }
+        return;
+    }
+    runBatch(cipher, tasks, count);
+}
+
+void otpParallelCipher(otpCipherFn cipher, char *out, const char *message, const char *key, size_t len) {
+    if (len < OTP_PARALLEL_THRESHOLD || poolThreads == 1) {
+        cipher(out, message, key, len);
+        return;
+    }
+
+    // Only the pool's caller writes batchSpan, and helpers read it after
+    // the generation bump under poolLock publishes it
+    batchSpan.out = out;
+    batchSpan.message = message;
+    batchSpan.key = key;
+    batchSpan.len = len;
+    runBatch(cipher, NULL, (len + OTP_PARALLEL_RANGE - 1) / OTP_PARALLEL_RANGE);
+}
@@ -0,0 +1,49 @@
+#ifndef OTP_PARALLEL_H
+#define OTP_PARALLEL_H
+
+#include <stddef.h>
+
+#include "otp_cipher.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Messages shorter than this are ciphered on the calling thread; splitting
+// them costs more than it saves
+#define OTP_PARALLEL_THRESHOLD (4 * 1024 * 1024)
+
+// Size of the ranges a large message is split into. A range of message, key
+// and output stays within a typical L2 cache.
+#define OTP_PARALLEL_RANGE (64 * 1024)
+
+// One contiguous range of work
+struct otpParallelTask {
+    char *out;
+    const char *message;
+    const char *key;
+    size_t len;
+};
+
+// Start the pool with threads - 1 helper threads; the caller of
+// otpParallelRun() is the last one. Call once per process, after any fork().
+// Returns 0 on success, -1 if the helpers could not be started.
+int otpParallelInit(int threads);
+
+// Number of threads (including the caller) that otpParallelRun() spreads
+// work over. 1 until otpParallelInit() succeeds.
+int otpParallelThreads(void);
+
+// Run cipher over every task, spread across the pool, and return once all of
+// them are done. Not reentrant: one caller at a time.
+void otpParallelRun(otpCipherFn cipher, const struct otpParallelTask *tasks, size_t count);
+
+// Cipher len bytes, split into OTP_PARALLEL_RANGE ranges across the pool when
+// len is at least OTP_PARALLEL_THRESHOLD
+void otpParallelCipher(otpCipherFn cipher, char *out, const char *message, const char *key, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+#include "otp_pool.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define CLASS_COUNT 7 // 128 KiB .. 8 MiB
+
+// Free buffers link through their first bytes
+struct freeBuffer {
+    struct freeBuffer *next;
+};
+
+struct sizeClass {
+    struct freeBuffer *free;
+    size_t count;
+    size_t lowWater; // fewest free buffers since the last trim
+};
+
+static struct sizeClass classes[CLASS_COUNT];
+static size_t cachedBytes;
+static size_t cachedCap;
+
+// Arena buffers have a free list of their own, outside the cap and trimming
+static char *arena;
+static size_t arenaLen;
+static struct freeBuffer *arenaFree;
+
+static int inArena(const void *buffer) {
+    return arena && (const char *)buffer >= arena && (const char *)buffer < arena + arenaLen;
+}
+
+// Index of the smallest class holding size bytes, or -1 if none does
+static int classOf(size_t size) {
+    size_t classSize = OTP_POOL_MIN_SIZE;
+    for (int i = 0; i < CLASS_COUNT; i++, classSize *= 2) {
+        if (size <= classSize) return i;
+    }
+    return -1;
+}
+
+void otpPoolInit(size_t cap) {
+    cachedCap = cap;
+}
+
+void *otpPoolGet(size_t size, size_t *capacity) {
+    int index = classOf(size);
+    if (index < 0) {
+        *capacity = size;
+        return malloc(size);
+    }
+
+    struct sizeClass *sizeClass = &classes[index];
+    *capacity = (size_t)OTP_POOL_MIN_SIZE << index;
+    if (index == 0 && arenaFree) {
+        struct freeBuffer *buffer = arenaFree;
+        arenaFree = buffer->next;
+        return buffer;
+    }
+    if (!sizeClass->free) return malloc(*capacity);
+
+    struct freeBuffer *buffer = sizeClass->free;
+    sizeClass->free = buffer->next;
+    sizeClass->count--;
+    if (sizeClass->count < sizeClass->lowWater) sizeClass->lowWater = sizeClass->count;
+    cachedBytes -= *capacity;
+    return buffer;
+}
+
+void otpPoolPut(void *buffer, size_t capacity) {
+    if (!buffer) return;
+
+    if (inArena(buffer)) {
+        struct freeBuffer *node = buffer;
+        node->next = arenaFree;
+        arenaFree = node;
+        return;
+    }
+
+    int index = classOf(capacity);
+    if (index < 0 || ((size_t)OTP_POOL_MIN_SIZE << index) != capacity || cachedBytes + capacity > cachedCap) {
+        free(buffer);
+        return;
+    }
+
+    struct sizeClass *sizeClass = &classes[index];
+    struct freeBuffer *node = buffer;
+    node->next = sizeClass->free;
+    sizeClass->free = node;
+    sizeClass->count++;
+    cachedBytes += capacity;
+}
+
+void otpPoolTrim(void) {
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        struct sizeClass *sizeClass = &classes[i];
+        size_t capacity = (size_t)OTP_POOL_MIN_SIZE << i;
+        for (; sizeClass->lowWater > 0; sizeClass->lowWater--) {
+            struct freeBuffer *buffer = sizeClass->free;
+            sizeClass->free = buffer->next;
+            sizeClass->count--;
+            cachedBytes -= capacity;
+            free(buffer);
+        }
+        sizeClass->lowWater = sizeClass->count;
+    }
+}
+
+void *otpPoolArena(size_t count, size_t *len) {
+    if (arena || count == 0 || count > SIZE_MAX / OTP_POOL_MIN_SIZE) return NULL;
+
+    size_t size = count * OTP_POOL_MIN_SIZE;
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) return NULL;
+
+    arena = region;
+    arenaLen = size;
+    for (size_t i = count; i-- > 0;) {
+        struct freeBuffer *node = (struct freeBuffer *)(arena + i * OTP_POOL_MIN_SIZE);
+        node->next = arenaFree;
+        arenaFree = node;
+    }
+    *len = size;
+    return arena;
+}
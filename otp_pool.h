@@ -0,0 +1,34 @@
+#ifndef OTP_POOL_H
+#define OTP_POOL_H
+
+#include <stddef.h>
+
+// Reusable buffers for one worker process, in power-of-two size classes from
+// OTP_POOL_MIN_SIZE to OTP_POOL_MAX_SIZE. Buffers given back are kept for
+// the next request of their class as long as the pool holds less than its
+// cap; otpPoolTrim() frees the ones that sat unused since the last trim.
+// Requests larger than OTP_POOL_MAX_SIZE bypass the pool. Not thread safe:
+// one pool per single-threaded event loop.
+#define OTP_POOL_MIN_SIZE (128 * 1024)
+#define OTP_POOL_MAX_SIZE (8 * 1024 * 1024)
+
+// Set the most bytes the pool keeps cached. Defaults to 0: nothing cached.
+void otpPoolInit(size_t cap);
+
+// A buffer of at least size bytes, or NULL. *capacity is set to its real
+// size, which must be passed back to otpPoolPut().
+void *otpPoolGet(size_t size, size_t *capacity);
+
+// Give back a buffer from otpPoolGet(). NULL is ignored.
+void otpPoolPut(void *buffer, size_t capacity);
+
+// Free the buffers that were not needed since the previous trim
+void otpPoolTrim(void);
+
+// Carve count buffers of OTP_POOL_MIN_SIZE out of one region that is never
+// freed or trimmed, so it can be registered with the kernel for fixed-buffer
+// I/O. otpPoolGet() hands them out before allocating. Returns the region and
+// sets *len to its size, or returns NULL. Call at most once.
+void *otpPoolArena(size_t count, size_t *len);
+
+#endif
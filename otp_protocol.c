@@ -0,0 +1,476 @@
+#include "otp_protocol.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+
+// A request answered with OTP_STATUS_BUSY is sent again after a delay that
+// starts at BUSY_RETRY_FIRST_MS and doubles, up to BUSY_RETRY_MAX_MS, while
+// the server stays busy. A job turned away BUSY_RETRY_LIMIT times fails.
+#define BUSY_RETRY_FIRST_MS 10
+#define BUSY_RETRY_MAX_MS 1000
+#define BUSY_RETRY_LIMIT 30
+
+static void put16(unsigned char *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+    put16(p, v >> 16);
+    put16(p + 2, v);
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+    put32(p, v >> 32);
+    put32(p + 4, v);
+}
+
+static uint16_t get16(const unsigned char *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t get32(const unsigned char *p) {
+    return (uint32_t)get16(p) << 16 | get16(p + 2);
+}
+
+static uint64_t get64(const unsigned char *p) {
+    return (uint64_t)get32(p) << 32 | get32(p + 4);
+}
+
+void otpPackRequest(unsigned char *wire, const struct otpRequest *request) {
+    put32(wire, request->magic);
+    wire[4] = request->version;
+    wire[5] = request->op;
+    put16(wire + 6, request->flags);
+    put32(wire + 8, request->jobId);
+    put64(wire + 12, request->msgLen);
+    put64(wire + 20, request->keyLen);
+}
+
+void otpUnpackRequest(const unsigned char *wire, struct otpRequest *request) {
+    request->magic = get32(wire);
+    request->version = wire[4];
+    request->op = wire[5];
+    request->flags = get16(wire + 6);
+    request->jobId = get32(wire + 8);
+    request->msgLen = get64(wire + 12);
+    request->keyLen = get64(wire + 20);
+}
+
+void otpPackResponse(unsigned char *wire, const struct otpResponse *response) {
+    put32(wire, response->magic);
+    wire[4] = response->version;
+    wire[5] = response->status;
+    put16(wire + 6, 0);
+    put32(wire + 8, response->jobId);
+    put64(wire + 12, response->msgLen);
+}
+
+void otpUnpackResponse(const unsigned char *wire, struct otpResponse *response) {
+    response->magic = get32(wire);
+    response->version = wire[4];
+    response->status = wire[5];
+    response->jobId = get32(wire + 8);
+    response->msgLen = get64(wire + 12);
+}
+
+void otpPackKeyRef(unsigned char *wire, const struct otpKeyRef *ref) {
+    memset(wire, 0, OTP_KEY_ID_SIZE);
+    memcpy(wire, ref->id, strnlen(ref->id, OTP_KEY_ID_SIZE));
+    put64(wire + OTP_KEY_ID_SIZE, ref->offset);
+}
+
+void otpUnpackKeyRef(const unsigned char *wire, struct otpKeyRef *ref) {
+    memcpy(ref->id, wire, OTP_KEY_ID_SIZE);
+    ref->id[OTP_KEY_ID_SIZE] = '\0';
+    ref->offset = get64(wire + OTP_KEY_ID_SIZE);
+}
+
+void otpPackKeyOffset(unsigned char *wire, uint64_t offset) {
+    put64(wire, offset);
+}
+
+uint64_t otpUnpackKeyOffset(const unsigned char *wire) {
+    return get64(wire);
+}
+
+int otpKeyIdValid(const char *id) {
+    size_t len = strlen(id);
+    if (len == 0 || len > OTP_KEY_ID_SIZE || id[0] == '.') return 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = id[i];
+        if (!isalnum((unsigned char)c) && c != '_' && c != '-' && c != '.') return 0;
+    }
+    return 1;
+}
+
+int otpCheckRequest(const struct otpRequest *request, unsigned ops) {
+    if (request->magic != OTP_MAGIC) return OTP_STATUS_BAD_MAGIC;
+    if (request->version != OTP_VERSION) return OTP_STATUS_BAD_VERSION;
+    if (request->op >= 32 || !(ops & OTP_OP_BIT(request->op))) return OTP_STATUS_BAD_OP;
+    if (request->flags & ~OTP_FLAGS_KNOWN) return OTP_STATUS_UNSUPPORTED;
+    if (request->flags & OTP_FLAG_KEY_REF) {
+        // The key comes from the server's pad; none may follow
+        if (request->keyLen != 0) return OTP_STATUS_UNSUPPORTED;
+    } else if (request->keyLen < request->msgLen) {
+        return OTP_STATUS_KEY_TOO_SHORT;
+    }
+    return OTP_STATUS_OK;
+}
+
+int otpIsUnixAddress(const char *address) {
+    return address[0] == '/' || address[0] == '@';
+}
+
+int otpUnixAddress(const char *address, struct sockaddr_un *addr, socklen_t *addrLen) {
+    size_t len = strlen(address);
+    if (len >= sizeof(addr->sun_path)) return -1;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (address[0] == '@') {
+        // Abstract names start with a NUL and are not NUL terminated
+        memcpy(addr->sun_path + 1, address + 1, len - 1);
+        *addrLen = offsetof(struct sockaddr_un, sun_path) + len;
+    } else {
+        memcpy(addr->sun_path, address, len);
+        *addrLen = offsetof(struct sockaddr_un, sun_path) + len + 1;
+    }
+    return 0;
+}
+
+const char *otpStatusString(int status) {
+    switch (status) {
+    case OTP_STATUS_OK: return "ok";
+    case OTP_STATUS_BAD_MAGIC: return "not an otp request";
+    case OTP_STATUS_BAD_VERSION: return "unsupported protocol version";
+    case OTP_STATUS_BAD_OP: return "operation not served here";
+    case OTP_STATUS_UNSUPPORTED: return "unsupported request flags";
+    case OTP_STATUS_KEY_TOO_SHORT: return "key is too short";
+    case OTP_STATUS_NO_SUCH_KEY: return "no such key on the server";
+    case OTP_STATUS_BAD_KEY_REF: return "bad key offset";
+    case OTP_STATUS_BUSY: return "server busy, retry later";
+    case OTP_STATUS_TOO_LARGE: return "message too large";
+    default: return "unknown status";
+    }
+}
+
+// One contiguous piece of a request stream: either in memory at data, or in
+// the file fd at offset
+struct segment {
+    const char *data;
+    int fd;
+    off_t offset;
+    size_t len;
+};
+
+static void fileOrMemory(struct segment *segment, const char *data, int fd, size_t offset) {
+    segment->fd = fd;
+    segment->data = fd < 0 ? data + offset : NULL;
+    segment->offset = (off_t)offset;
+}
+
+// Locate the next unsent piece of a job's request stream. sent counts bytes
+// of the stream: the prefix (header and any key reference) followed by the
+// message interleaved with the key, or the message alone for a key reference.
+static void streamSegment(const unsigned char *prefix, size_t prefixLen, const struct otpJob *job,
+                          size_t sent, struct segment *segment) {
+    if (sent < prefixLen) {
+        segment->data = (const char *)prefix + sent;
+        segment->fd = -1;
+        segment->len = prefixLen - sent;
+        return;
+    }
+    sent -= prefixLen;
+
+    if (job->keyId) {
+        fileOrMemory(segment, job->message, job->messageFD, sent);
+        segment->len = job->len - sent;
+        return;
+    }
+
+    size_t base = sent / (2 * (size_t)OTP_CHUNK_SIZE) * OTP_CHUNK_SIZE;
+    size_t n = job->len - base < OTP_CHUNK_SIZE ? job->len - base : OTP_CHUNK_SIZE;
+    size_t within = sent - 2 * base;
+
+    if (within < n) {
+        fileOrMemory(segment, job->message, job->messageFD, base + within);
+        segment->len = n - within;
+        return;
+    }
+    fileOrMemory(segment, job->key, job->keyFD, base + within - n);
+    segment->len = 2 * n - within;
+}
+
+// Send as much of a segment as the socket takes without blocking
+static ssize_t sendSegment(int socket, struct segment *segment) {
+    if (segment->fd >= 0) {
+        return sendfile(socket, segment->fd, &segment->offset, segment->len);
+    }
+    return send(socket, segment->data, segment->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+// Write out every finished job from *nextOutput onwards that is next in line
+static int flushFinished(struct otpJob *jobs, size_t count, size_t *nextOutput, FILE *out) {
+    while (*nextOutput < count && jobs[*nextOutput].finished) {
+        struct otpJob *job = &jobs[*nextOutput];
+        if (job->result) {
+            size_t written = fwrite(job->result, 1, job->len, out);
+            free(job->result);
+            job->result = NULL;
+            if (written != job->len) return -1;
+        }
+        (*nextOutput)++;
+    }
+    return 0;
+}
+
+static uint64_t nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+int otpClientPipeline(int socket, struct otpJob *jobs, size_t count, size_t window, FILE *out) {
+    unsigned char prefix[OTP_REQUEST_SIZE + OTP_KEY_REF_SIZE];
+    size_t prefixLen = 0;   // bytes of prefix used by the job being sent
+    struct otpJob *sending = NULL; // job currently being sent
+    size_t sent = 0;        // bytes of its request stream already sent
+    size_t nextNew = 0;     // first job not sent yet
+    size_t inFlight = 0;    // jobs sent or being sent and not yet answered
+    size_t finished = 0;    // jobs fully answered
+    size_t nextOutput = 0;  // first job whose output is not yet written
+
+    // Jobs the server was too busy for, to send again once retryAt passes
+    size_t *retries = malloc(count * sizeof(*retries));
+    size_t retryHead = 0, retryCount = 0;
+    uint64_t retryAt = 0;
+    unsigned backoff = BUSY_RETRY_FIRST_MS;
+    if (count > 0 && !retries) return -1;
+
+    unsigned char responseHeader[OTP_RESPONSE_SIZE + OTP_KEY_OFFSET_SIZE];
+    size_t headerReceived = 0;
+    size_t headerWant = OTP_RESPONSE_SIZE; // grows by the key offset for key references
+    struct otpJob *receiving = NULL; // job whose output is arriving
+    char buffer[OTP_CHUNK_SIZE];
+    int status = OTP_STATUS_OK;
+
+    // sendfile() has no MSG_DONTWAIT, so the socket itself is made
+    // nonblocking while the pipeline runs
+    int socketFlags = fcntl(socket, F_GETFL);
+    if (socketFlags < 0 || fcntl(socket, F_SETFL, socketFlags | O_NONBLOCK) < 0) {
+        free(retries);
+        return -1;
+    }
+
+    if (window == 0) window = 1;
+    for (size_t i = 0; i < count; i++) {
+        jobs[i].result = NULL;
+        jobs[i].received = 0;
+        jobs[i].finished = 0;
+        jobs[i].outstanding = 0;
+        jobs[i].busy = 0;
+        jobs[i].attempts = 0;
+    }
+
+    // Sending and receiving are interleaved with poll() so that neither side
+    // can stall with full socket buffers waiting for the other to read. Up to
+    // window jobs are in flight at once.
+    while (finished < count) {
+        uint64_t now = nowMs();
+        int retryDue = retryCount > 0 && now >= retryAt;
+        int canSend = sending || (inFlight < window && (retryDue || nextNew < count));
+        struct pollfd pfd = { .fd = socket, .events = POLLIN };
+        if (canSend) pfd.events |= POLLOUT;
+
+        // Wake up for a pending retry even if the socket stays quiet
+        int timeout = -1;
+        if (!canSend && retryCount > 0 && inFlight < window) timeout = (int)(retryAt - now);
+
+        if (poll(&pfd, 1, timeout) < 0) {
+            if (errno == EINTR) continue;
+            status = -1;
+            break;
+        }
+
+        if (canSend && (pfd.revents & POLLOUT)) {
+            if (!sending) {
+                size_t index;
+                if (retryDue) {
+                    index = retries[retryHead];
+                    retryHead = (retryHead + 1) % count;
+                    retryCount--;
+                } else {
+                    index = nextNew++;
+                }
+                sending = &jobs[index];
+                sending->outstanding = 1;
+                sending->attempts++;
+                inFlight++;
+
+                struct otpRequest request = {
+                    .magic = OTP_MAGIC,
+                    .version = OTP_VERSION,
+                    .op = sending->op,
+                    .flags = sending->keyId ? OTP_FLAG_KEY_REF : 0,
+                    .jobId = (uint32_t)index,
+                    .msgLen = sending->len,
+                    .keyLen = sending->keyId ? 0 : sending->len,
+                };
+                otpPackRequest(prefix, &request);
+                prefixLen = OTP_REQUEST_SIZE;
+                if (sending->keyId) {
+                    struct otpKeyRef ref = { .offset = sending->keyOffset };
+                    strncpy(ref.id, sending->keyId, OTP_KEY_ID_SIZE);
+                    ref.id[OTP_KEY_ID_SIZE] = '\0';
+                    otpPackKeyRef(prefix + OTP_REQUEST_SIZE, &ref);
+                    prefixLen += OTP_KEY_REF_SIZE;
+                }
+            }
+
+            struct segment segment;
+            streamSegment(prefix, prefixLen, sending, sent, &segment);
+            ssize_t bytesSent = sendSegment(socket, &segment);
+            if (bytesSent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                status = -1;
+                break;
+            }
+            if (bytesSent > 0) sent += bytesSent;
+            if (sent == prefixLen + (sending->keyId ? 1 : 2) * sending->len) {
+                // A job turned away while it was still being sent goes back
+                // in line now that the server has had all of it
+                if (sending->busy) {
+                    sending->busy = 0;
+                    retries[(retryHead + retryCount++) % count] = sending - jobs;
+                }
+                sending = NULL;
+                sent = 0;
+            }
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            char *target;
+            size_t want;
+            if (!receiving) {
+                target = (char *)responseHeader + headerReceived;
+                want = headerWant - headerReceived;
+            } else {
+                size_t left = receiving->len - receiving->received;
+                target = receiving->result ? receiving->result + receiving->received : buffer;
+                want = left < sizeof(buffer) ? left : sizeof(buffer);
+            }
+
+            ssize_t bytesReceived = recv(socket, target, want, MSG_DONTWAIT);
+            if (bytesReceived == 0) {
+                status = -1; // Server closed connection early
+                break;
+            }
+            if (bytesReceived < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+                status = -1;
+                break;
+            }
+
+            if (!receiving) {
+                headerReceived += bytesReceived;
+                if (headerReceived < headerWant) continue;
+
+                struct otpResponse response;
+                otpUnpackResponse(responseHeader, &response);
+                if (response.magic != OTP_MAGIC || response.jobId >= count || !jobs[response.jobId].outstanding) {
+                    status = -1;
+                    break;
+                }
+                struct otpJob *job = &jobs[response.jobId];
+
+                // The server dropped the request and keeps the connection
+                // open; try it again later, backing off while it stays busy
+                if (response.status == OTP_STATUS_BUSY) {
+                    headerReceived = 0;
+                    job->outstanding = 0;
+                    inFlight--;
+                    if (job->attempts >= BUSY_RETRY_LIMIT) {
+                        status = OTP_STATUS_BUSY;
+                        break;
+                    }
+                    if (job == sending) {
+                        job->busy = 1;
+                    } else {
+                        retries[(retryHead + retryCount++) % count] = response.jobId;
+                    }
+                    retryAt = nowMs() + backoff;
+                    backoff = backoff * 2 < BUSY_RETRY_MAX_MS ? backoff * 2 : BUSY_RETRY_MAX_MS;
+                    continue;
+                }
+                if (response.status != OTP_STATUS_OK) {
+                    status = response.status;
+                    break;
+                }
+                backoff = BUSY_RETRY_FIRST_MS;
+                if (job->finished || response.msgLen != job->len) {
+                    status = -1;
+                    break;
+                }
+
+                // An accepted key reference is answered with the pad offset
+                if (job->keyId) {
+                    if (headerWant == OTP_RESPONSE_SIZE) {
+                        headerWant += OTP_KEY_OFFSET_SIZE;
+                        continue;
+                    }
+                    job->keyOffset = otpUnpackKeyOffset(responseHeader + OTP_RESPONSE_SIZE);
+                }
+                headerReceived = 0;
+                headerWant = OTP_RESPONSE_SIZE;
+
+                // Output goes straight through when this job is next in line,
+                // otherwise it is held until the jobs before it are written
+                if (response.jobId != nextOutput && job->len > 0) {
+                    job->result = malloc(job->len);
+                    if (!job->result) {
+                        status = -1;
+                        break;
+                    }
+                }
+                receiving = job;
+            } else {
+                if (!receiving->result && fwrite(buffer, 1, bytesReceived, out) != (size_t)bytesReceived) {
+                    status = -1; // out is full or closed
+                    break;
+                }
+                receiving->received += bytesReceived;
+            }
+
+            if (receiving && receiving->received == receiving->len) {
+                receiving->finished = 1;
+                receiving->outstanding = 0;
+                receiving = NULL;
+                inFlight--;
+                finished++;
+                if (flushFinished(jobs, count, &nextOutput, out) < 0) {
+                    status = -1;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Every way out hands the socket back as it came and flushes what was
+    // written; results held for jobs that never got their turn are dropped
+    free(retries);
+    for (size_t i = 0; i < count; i++) {
+        free(jobs[i].result);
+        jobs[i].result = NULL;
+    }
+    if (fflush(out) != 0 && status == OTP_STATUS_OK) status = -1;
+    fcntl(socket, F_SETFL, socketFlags);
+    return status;
+}
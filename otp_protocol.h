@@ -0,0 +1,197 @@
+#ifndef OTP_PROTOCOL_H
+#define OTP_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// After the handshake every job starts with a fixed-size request header.
+// All multi-byte fields are in network byte order.
+//
+//   request:  magic[4] version[1] op[1] flags[2] jobId[4] msgLen[8] keyLen[8]
+//   response: magic[4] version[1] status[1] reserved[2] jobId[4] msgLen[8]
+//
+// The message and the first msgLen key bytes then travel interleaved in
+// chunks of at most OTP_CHUNK_SIZE bytes, so a server only ever holds one
+// chunk of each:
+//
+//   header | msg[0, n0) key[0, n0) | msg[n0, n0 + n1) key[n0, n0 + n1) | ... | key[msgLen, keyLen)
+//
+// where every chunk is OTP_CHUNK_SIZE bytes except possibly the last, and any
+// key bytes past msgLen are read and discarded. The server answers with a
+// response header and, if the status is OTP_STATUS_OK, streams msgLen bytes
+// of output as each chunk is ciphered. OTP_STATUS_BUSY means the server is
+// over its in-flight budget: it reads and drops the rest of the request, the
+// connection stays open and the client may send the request again later.
+// On any other status the server sends nothing after the response header,
+// ignores the rest of the input and closes the connection once the client
+// has.
+//
+// With OTP_FLAG_KEY_REF the key is instead a pad the server already holds:
+// keyLen is 0, a key reference follows the header and only the message is
+// streamed, in chunks of at most OTP_CHUNK_SIZE bytes:
+//
+//   key reference: id[32] offset[8]
+//
+//   header | key reference | msg[0, n0) | msg[n0, n0 + n1) | ...
+//
+// The id names the pad, NUL padded, and the message is ciphered with pad
+// bytes [offset, offset + msgLen). An offset of OTP_KEY_OFFSET_NEXT asks an
+// encrypting server to reserve the next unused range of the pad from its
+// ledger. An explicit offset for encryption must be at or past the ledger's
+// next unused offset, or the request is rejected with
+// OTP_STATUS_BAD_KEY_REF; decryption requires an explicit offset. The
+// response to an accepted key reference is followed by the offset that was
+// used:
+//
+//   response | offset[8] | output
+//
+// A connection carries any number of jobs. Clients may send further requests
+// without waiting for earlier answers; the response header echoes the
+// request's jobId and responses may come back in any order, but the output
+// of one job is never split by another's.
+#define OTP_MAGIC 0x4F545050u // "OTPP"
+#define OTP_VERSION 2
+
+#define OTP_REQUEST_SIZE 28
+#define OTP_RESPONSE_SIZE 20
+
+#define OTP_CHUNK_SIZE (64 * 1024)
+
+// Number of jobs the clients keep in flight on one connection
+#define OTP_PIPELINE_DEPTH 32
+
+// Operations
+#define OTP_OP_ENCRYPT 1
+#define OTP_OP_DECRYPT 2
+
+// Sets of operations, e.g. those a server performs
+#define OTP_OP_BIT(op) (1u << (op))
+#define OTP_OPS_ALL (OTP_OP_BIT(OTP_OP_ENCRYPT) | OTP_OP_BIT(OTP_OP_DECRYPT))
+
+// A connection opens with the client sending a handshake string and the
+// server answering with its own: "otp_client"/"otp_server" for clients that
+// may request either operation, or the legacy "enc_client"/"enc_server" and
+// "dec_client"/"dec_server" pairs, which limit the connection to one. All of
+// them are this long.
+#define OTP_HANDSHAKE_SIZE 10
+
+// Request flags. Servers reject bits they do not understand so clients can
+// probe for optional features.
+#define OTP_FLAG_KEY_REF 0x0001 // the key is a pad held by the server
+#define OTP_FLAGS_KNOWN OTP_FLAG_KEY_REF
+
+// Key references
+#define OTP_KEY_ID_SIZE 32
+#define OTP_KEY_REF_SIZE 40
+#define OTP_KEY_OFFSET_SIZE 8
+#define OTP_KEY_OFFSET_NEXT UINT64_MAX
+
+// Response status codes
+#define OTP_STATUS_OK 0
+#define OTP_STATUS_BAD_MAGIC 1
+#define OTP_STATUS_BAD_VERSION 2
+#define OTP_STATUS_BAD_OP 3
+#define OTP_STATUS_UNSUPPORTED 4
+#define OTP_STATUS_KEY_TOO_SHORT 5
+#define OTP_STATUS_NO_SUCH_KEY 6
+#define OTP_STATUS_BAD_KEY_REF 7
+#define OTP_STATUS_BUSY 8
+#define OTP_STATUS_TOO_LARGE 9
+
+struct otpRequest {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t op;
+    uint16_t flags;
+    uint32_t jobId;
+    uint64_t msgLen;
+    uint64_t keyLen;
+};
+
+struct otpResponse {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t status;
+    uint32_t jobId;
+    uint64_t msgLen;
+};
+
+struct otpKeyRef {
+    char id[OTP_KEY_ID_SIZE + 1];
+    uint64_t offset;
+};
+
+void otpPackRequest(unsigned char *wire, const struct otpRequest *request);
+void otpUnpackRequest(const unsigned char *wire, struct otpRequest *request);
+void otpPackResponse(unsigned char *wire, const struct otpResponse *response);
+void otpUnpackResponse(const unsigned char *wire, struct otpResponse *response);
+void otpPackKeyRef(unsigned char *wire, const struct otpKeyRef *ref);
+void otpUnpackKeyRef(const unsigned char *wire, struct otpKeyRef *ref);
+void otpPackKeyOffset(unsigned char *wire, uint64_t offset);
+uint64_t otpUnpackKeyOffset(const unsigned char *wire);
+
+// Whether id can name a pad: 1 to OTP_KEY_ID_SIZE letters, digits, '_', '-'
+// or '.', not starting with '.'
+int otpKeyIdValid(const char *id);
+
+// Check a request header a server has received. Returns OTP_STATUS_OK or the
+// status to reject it with. ops is the set of operations allowed on the
+// connection.
+int otpCheckRequest(const struct otpRequest *request, unsigned ops);
+
+// Servers and clients take a TCP port or, for clients on the same host, a
+// Unix domain socket: "/path" names one in the filesystem and "@name" one
+// in the abstract namespace. The protocol is the same over both.
+int otpIsUnixAddress(const char *address);
+
+// Fill in addr and *addrLen, the length to pass to bind() or connect(), for
+// a Unix domain socket address as above. Returns -1 if the name is too long.
+int otpUnixAddress(const char *address, struct sockaddr_un *addr, socklen_t *addrLen);
+
+// Human readable text for a status code
+const char *otpStatusString(int status);
+
+// A job submitted by a client. If messageFD or keyFD is not -1, that part is
+// sent from the file with sendfile() instead of being copied out of memory;
+// its text must start at offset 0 of the file. If keyId is not NULL the key
+// is that pad on the server, from keyOffset on, and key and keyFD are unused;
+// keyOffset is then set to the offset the server actually used.
+struct otpJob {
+    int op;
+    const char *message;
+    const char *key;
+    size_t len;
+    int messageFD;
+    int keyFD;
+    const char *keyId;
+    uint64_t keyOffset;
+
+    // Bookkeeping used by otpClientPipeline()
+    char *result;
+    size_t received;
+    int finished;
+    int outstanding; // sent, or being sent, and not answered yet
+    int busy;        // turned away while still being sent
+    int attempts;
+};
+
+// Client side of a connection: send the jobs in order, keeping up to window
+// of them in flight, and write their results to out in job order as they
+// arrive. Job ids are the indexes into jobs. Jobs the server is too busy
+// for are sent again with backoff. Returns OTP_STATUS_OK, the status the
+// server rejected a job with, or -1 if the connection failed or closed
+// early.
+int otpClientPipeline(int socket, struct otpJob *jobs, size_t count, size_t window, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
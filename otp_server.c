@@ -0,0 +1,1429 @@
+#define _GNU_SOURCE // accept4(), sched_setaffinity()
+
+#include "otp_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "otp_cipher.h"
+#include "otp_keystore.h"
+#include "otp_metrics.h"
+#include "otp_parallel.h"
+#include "otp_pool.h"
+#include "otp_protocol.h"
+#include "otp_uring.h"
+
+#define MAX_EVENTS 256
+
+// Chunk pairs a large job receives per batch for each cipher thread, and the
+// most a batch may hold. A batch is ciphered one chunk pair per task.
+#define BATCH_CHUNKS_PER_THREAD 2
+#define MAX_BATCH_CHUNKS 64
+
+// Cipher threads each worker gets when neither -w nor -t is given; the
+// default worker count is the online CPUs divided by this
+#define DEFAULT_WORKER_THREADS 4
+
+// Pending output is a control message plus up to a batch of data chunks
+#define OUTPUT_IOVECS (1 + MAX_BATCH_CHUNKS)
+
+// Most bytes of idle batch buffers a worker keeps for reuse, and how often
+// the ones that went unused are handed back to the heap
+#define POOL_CAP (64 * 1024 * 1024)
+#define POOL_TRIM_INTERVAL_MS 1000
+
+// Per-connection state machine. Input is read straight into whatever the
+// current state is waiting for; a state only advances once all its bytes
+// have arrived, so a client trickling data ties up nothing but its own
+// connection.
+enum connState {
+    CONN_HANDSHAKE,   // waiting for the client's handshake string
+    CONN_HEADER,      // waiting for a request header
+    CONN_KEY_REF,     // waiting for the key reference that follows a header
+    CONN_PAYLOAD,     // waiting for the next batch of message (and key) chunks
+    CONN_DISCARD,     // dropping key bytes past the message, or a request
+                      // turned away as busy
+    CONN_DRAIN,       // request rejected; dropping input until the client closes
+};
+
+struct connection {
+    int fd;
+    enum connState state;
+    size_t got;                  // bytes of the current item received so far
+
+    char handshake[OTP_HANDSHAKE_SIZE + 1];
+    unsigned ops;                // operations the handshake allows here
+    unsigned char header[OTP_REQUEST_SIZE];
+    unsigned char keyRef[OTP_KEY_REF_SIZE];
+    struct otpRequest request;   // the request being served
+    otpCipherFn cipher;          // and its kernel
+    const char *key;             // server pad bytes for the next batch, or NULL
+                                 // if the client streams the key
+    uint64_t remaining;          // message bytes of the job not yet received
+    uint64_t discard;            // input bytes of the request still to drop
+    uint64_t admitted;           // bytes this job holds of the in-flight budget
+    size_t batchChunks;          // chunk pairs received per batch for this job
+    size_t batchLen;             // message bytes in the batch being received
+
+    // Batch of message chunk/key chunk pairs, or of message chunks alone
+    // when the key is a server pad. Message chunk i is at stride * i *
+    // OTP_CHUNK_SIZE.
+    // The buffer is borrowed from the worker's pool for the length of a
+    // job's payload.
+    char *buffer;
+    size_t bufferSize;
+    size_t stride;
+
+    // Pending output: a control message (handshake reply or response header)
+    // followed by ciphered data, which lives in the message half of each
+    // chunk pair in buffer
+    unsigned char control[OTP_RESPONSE_SIZE + 16];
+    size_t controlLen;
+    size_t controlSent;
+    size_t dataLen;
+    size_t dataSent;
+    int closeAfterFlush;
+
+    // Stage timings for the metrics, in otpMetricsNow() nanoseconds
+    uint64_t acceptedAt;
+    uint64_t jobStart;       // first byte of the current request header
+    uint64_t stageStart;     // when the batch being received or sent began
+    uint64_t receiveNs;      // this job's totals so far
+    uint64_t cipherNs;
+    uint64_t sendNs;
+    int jobActive;           // an accepted job's output is not all sent yet
+    int sending;             // a ciphered batch is waiting to be sent
+
+    // Jobs of serverConfig->largeJob bytes or more run in the large lane: a
+    // batch per pass of the event loop, after the small jobs have been
+    // served
+    int large;
+    int queued;              // waiting in the large lane
+    struct connection *nextQueued;
+};
+
+// Handshakes the server answers, and the operations each one allows
+static const struct handshake {
+    const char *client;
+    const char *server;
+    unsigned ops;
+} handshakes[] = {
+    { "otp_client", "otp_server", OTP_OPS_ALL },
+    { "enc_client", "enc_server", OTP_OP_BIT(OTP_OP_ENCRYPT) },
+    { "dec_client", "dec_server", OTP_OP_BIT(OTP_OP_DECRYPT) },
+};
+
+static const struct otpServerConfig *serverConfig;
+static char discardBuffer[OTP_CHUNK_SIZE];
+static uint64_t loopWoke; // when the event loop last returned from waiting
+static struct otpParallelTask batchTasks[MAX_BATCH_CHUNKS];
+
+// Message bytes of the jobs all workers are serving, shared between them
+// when the server has a --budget. Each worker also counts its own share in
+// workerInFlight[worker], at ownInFlight, so that when a worker dies the
+// parent can take back what its unfinished jobs held.
+static uint64_t *inFlightBytes;
+static uint64_t *workerInFlight;
+static uint64_t *ownInFlight;
+
+// The parent's worker pids, by worker number
+static pid_t *workerPids;
+
+// The worker's large lane, first come first served
+static struct connection *laneHead;
+static struct connection *laneTail;
+
+// Give back the budget a dead worker's jobs held
+static void reclaimBudget(pid_t pid) {
+    if (!workerInFlight) return;
+    for (int i = 0; i < serverConfig->workers; i++) {
+        if (workerPids[i] != pid) continue;
+        uint64_t held = __atomic_exchange_n(&workerInFlight[i], 0, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(inFlightBytes, held, __ATOMIC_RELAXED);
+        return;
+    }
+}
+
+// Signal handler to reap zombies
+static void handle_sigchld(int sig) {
+    (void)sig;
+    pid_t pid;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        reclaimBudget(pid);
+    }
+}
+
+static void setupAddressStruct(struct sockaddr_in* address, int portNumber) {
+    memset((char*) address, '\0', sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons(portNumber);
+    address->sin_addr.s_addr = INADDR_ANY;
+}
+
+static void releaseBuffer(struct connection *conn) {
+    otpPoolPut(conn->buffer, conn->bufferSize);
+    conn->buffer = NULL;
+    conn->bufferSize = 0;
+}
+
+// Admit the current request against the server's limits. Returns
+// OTP_STATUS_OK, OTP_STATUS_TOO_LARGE for a message over --max-message, or
+// OTP_STATUS_BUSY when the jobs in flight already hold the whole budget. A
+// job larger than the budget is still let through when nothing else is in
+// flight, so it is never turned away for good.
+static int admit(struct connection *conn) {
+    uint64_t len = conn->request.msgLen;
+    if (serverConfig->maxMessage && len > serverConfig->maxMessage) return OTP_STATUS_TOO_LARGE;
+    if (!inFlightBytes || len == 0) return OTP_STATUS_OK;
+
+    uint64_t before = __atomic_fetch_add(inFlightBytes, len, __ATOMIC_RELAXED);
+    if (before > 0 && before + len > serverConfig->budget) {
+        __atomic_fetch_sub(inFlightBytes, len, __ATOMIC_RELAXED);
+        return OTP_STATUS_BUSY;
+    }
+    // The worker's own count never holds bytes the total does not, so the
+    // parent never takes back more than was added, even for a worker that
+    // dies between the two updates
+    __atomic_fetch_add(ownInFlight, len, __ATOMIC_RELAXED);
+    conn->admitted = len;
+    return OTP_STATUS_OK;
+}
+
+// Give the current job's share of the budget back
+static void releaseAdmitted(struct connection *conn) {
+    if (conn->admitted == 0) return;
+    __atomic_fetch_sub(ownInFlight, conn->admitted, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(inFlightBytes, conn->admitted, __ATOMIC_RELAXED);
+    conn->admitted = 0;
+}
+
+static void queueLarge(struct connection *conn) {
+    if (conn->queued) return;
+    conn->queued = 1;
+    conn->nextQueued = NULL;
+    if (laneTail) laneTail->nextQueued = conn;
+    else laneHead = conn;
+    laneTail = conn;
+}
+
+static struct connection *nextLarge(void) {
+    struct connection *conn = laneHead;
+    laneHead = conn->nextQueued;
+    if (!laneHead) laneTail = NULL;
+    conn->queued = 0;
+    return conn;
+}
+
+static void closeConnection(struct connection *conn) {
+    otpMetricsAdd(OTP_COUNTER_CLOSED, 1);
+    releaseAdmitted(conn);
+    close(conn->fd); // also removes it from the epoll set
+    releaseBuffer(conn);
+    free(conn);
+}
+
+static void queueControl(struct connection *conn, const void *data, size_t len) {
+    memcpy(conn->control, data, len);
+    conn->controlLen = len;
+    conn->controlSent = 0;
+}
+
+// Start receiving the next batch of chunk pairs of the current job, or move
+// past the message once all of it has arrived
+static void nextBatch(struct connection *conn) {
+    conn->got = 0;
+    if (conn->remaining > 0) {
+        uint64_t most = conn->batchChunks * OTP_CHUNK_SIZE;
+        conn->batchLen = conn->remaining < most ? conn->remaining : most;
+        conn->state = CONN_PAYLOAD;
+    } else if (conn->discard > 0) {
+        conn->state = CONN_DISCARD;
+    } else {
+        conn->state = CONN_HEADER;
+    }
+}
+
+// Returns 0 on success, -1 if the connection should be dropped
+static int handleHandshake(struct connection *conn) {
+    for (size_t i = 0; i < sizeof(handshakes) / sizeof(handshakes[0]); i++) {
+        const struct handshake *handshake = &handshakes[i];
+        if (strcmp(conn->handshake, handshake->client) != 0) continue;
+
+        conn->ops = handshake->ops & serverConfig->ops;
+        if (!conn->ops) break;
+        queueControl(conn, handshake->server, OTP_HANDSHAKE_SIZE);
+        otpMetricsRecord(OTP_STAGE_HANDSHAKE, otpMetricsNow() - conn->acceptedAt);
+        conn->state = CONN_HEADER;
+        conn->got = 0;
+        return 0;
+    }
+    fprintf(stderr, "SERVER: Rejected connection from unknown client\n");
+    return -1;
+}
+
+// Queue the response header for the current request. Returns status. A busy
+// server keeps the connection; any other rejection closes it.
+static int respond(struct connection *conn, int status) {
+    struct otpResponse response = {
+        .magic = OTP_MAGIC,
+        .version = OTP_VERSION,
+        .status = status,
+        .jobId = conn->request.jobId,
+        .msgLen = conn->request.msgLen,
+    };
+    otpMetricsRecord(OTP_STAGE_HEADER, otpMetricsNow() - conn->jobStart);
+    if (status != OTP_STATUS_OK) {
+        otpMetricsReject(status);
+        releaseAdmitted(conn);
+        response.msgLen = 0;
+        if (status != OTP_STATUS_BUSY) {
+            fprintf(stderr, "SERVER: Rejected request: %s\n", otpStatusString(status));
+            conn->closeAfterFlush = 1;
+        }
+    }
+
+    unsigned char responseHeader[OTP_RESPONSE_SIZE];
+    otpPackResponse(responseHeader, &response);
+    queueControl(conn, responseHeader, sizeof(responseHeader));
+    return status;
+}
+
+// Set up to receive the payload of an accepted request. key is the pad to
+// use, or NULL if the client streams the key. Returns -1 on allocation
+// failure.
+static int startJob(struct connection *conn, const char *key) {
+    // Small jobs go one chunk at a time. Large ones collect several so the
+    // cipher threads can work on them at once.
+    conn->batchChunks = 1;
+    if (conn->request.msgLen >= OTP_PARALLEL_THRESHOLD) {
+        conn->batchChunks = otpParallelThreads() * BATCH_CHUNKS_PER_THREAD;
+        if (conn->batchChunks > MAX_BATCH_CHUNKS) conn->batchChunks = MAX_BATCH_CHUNKS;
+    }
+    conn->key = key;
+    conn->stride = key ? 1 : 2;
+    conn->large = serverConfig->largeJob && conn->request.msgLen >= serverConfig->largeJob;
+
+    // --conn-budget caps the batch buffer a connection holds, down to one
+    // chunk pair
+    if (serverConfig->connectionBudget) {
+        size_t most = serverConfig->connectionBudget / (conn->stride * OTP_CHUNK_SIZE);
+        if (most < 1) most = 1;
+        if (conn->batchChunks > most) conn->batchChunks = most;
+    }
+
+    // One batch of message chunks, plus key chunks if the client sends them
+    uint64_t most = conn->batchChunks * OTP_CHUNK_SIZE;
+    size_t needed = conn->stride * (conn->request.msgLen < most ? conn->request.msgLen : most);
+    if (needed > conn->bufferSize) {
+        releaseBuffer(conn);
+        conn->buffer = otpPoolGet(needed, &conn->bufferSize);
+        if (!conn->buffer) {
+            conn->bufferSize = 0;
+            return -1;
+        }
+    }
+
+    conn->remaining = conn->request.msgLen;
+    conn->discard = key ? 0 : conn->request.keyLen - conn->request.msgLen;
+    conn->jobActive = 1;
+    conn->receiveNs = conn->cipherNs = conn->sendNs = 0;
+    conn->stageStart = otpMetricsNow();
+    nextBatch(conn);
+    return 0;
+}
+
+static int handleHeader(struct connection *conn) {
+    otpUnpackRequest(conn->header, &conn->request);
+    otpMetricsAdd(OTP_COUNTER_REQUESTS, 1);
+
+    int status = otpCheckRequest(&conn->request, conn->ops);
+    if (status == OTP_STATUS_OK) status = admit(conn);
+    conn->cipher = conn->request.op == OTP_OP_ENCRYPT ? otpEncrypt : otpDecrypt;
+
+    // Turned away for now: read past the rest of the request, key
+    // reference or streamed key included, and wait for the next one
+    if (status == OTP_STATUS_BUSY) {
+        uint64_t rest = conn->request.flags & OTP_FLAG_KEY_REF ? OTP_KEY_REF_SIZE : conn->request.keyLen;
+        if (conn->request.msgLen > UINT64_MAX - rest) {
+            status = OTP_STATUS_TOO_LARGE;
+        } else {
+            respond(conn, status);
+            conn->remaining = 0;
+            conn->discard = conn->request.msgLen + rest;
+            nextBatch(conn);
+            return 0;
+        }
+    }
+
+    if (status == OTP_STATUS_OK && (conn->request.flags & OTP_FLAG_KEY_REF)) {
+        conn->state = CONN_KEY_REF;
+        conn->got = 0;
+        return 0;
+    }
+    if (respond(conn, status) != OTP_STATUS_OK) return 0;
+    return startJob(conn, NULL);
+}
+
+static int handleKeyRef(struct connection *conn) {
+    struct otpKeyRef ref;
+    otpUnpackKeyRef(conn->keyRef, &ref);
+
+    // Encryption reserves every range it uses in the pad's ledger, either
+    // the next unused one or the one asked for if nothing before it has
+    // been used. Decryption needs the offset the message was encrypted at.
+    const struct otpKey *key = otpKeyStoreFind(ref.id);
+    uint64_t len = conn->request.msgLen;
+    int encrypt = conn->request.op == OTP_OP_ENCRYPT;
+    int status = OTP_STATUS_OK;
+    if (!key) {
+        status = OTP_STATUS_NO_SUCH_KEY;
+    } else if (ref.offset == OTP_KEY_OFFSET_NEXT) {
+        if (!encrypt) {
+            status = OTP_STATUS_BAD_KEY_REF;
+        } else {
+            int reserved = otpKeyReserve(key, len, &ref.offset);
+            if (reserved < 0) return -1;
+            if (reserved > 0) status = OTP_STATUS_KEY_TOO_SHORT;
+        }
+    } else if (ref.offset > key->len || len > key->len - ref.offset) {
+        status = OTP_STATUS_KEY_TOO_SHORT;
+    } else if (encrypt) {
+        int reserved = otpKeyReserveAt(key, ref.offset, len);
+        if (reserved < 0) return -1;
+        if (reserved > 0) status = OTP_STATUS_BAD_KEY_REF;
+    }
+    if (respond(conn, status) != OTP_STATUS_OK) return 0;
+
+    otpPackKeyOffset(conn->control + conn->controlLen, ref.offset);
+    conn->controlLen += OTP_KEY_OFFSET_SIZE;
+    return startJob(conn, key->data + ref.offset);
+}
+
+static void handleBatch(struct connection *conn) {
+    // Cipher each message chunk in place, so the message chunks become the
+    // output. The key is the chunk that follows or a range of the pad.
+    uint64_t received = otpMetricsNow();
+    conn->receiveNs += received - conn->stageStart;
+    size_t count = 0;
+    for (size_t offset = 0; offset < conn->batchLen; offset += OTP_CHUNK_SIZE) {
+        size_t n = conn->batchLen - offset < OTP_CHUNK_SIZE ? conn->batchLen - offset : OTP_CHUNK_SIZE;
+        char *chunk = conn->buffer + conn->stride * offset;
+        batchTasks[count].out = chunk;
+        batchTasks[count].message = chunk;
+        batchTasks[count].key = conn->key ? conn->key + offset : chunk + n;
+        batchTasks[count].len = n;
+        count++;
+    }
+    otpParallelRun(conn->cipher, batchTasks, count);
+    if (conn->key) conn->key += conn->batchLen;
+    conn->stageStart = otpMetricsNow();
+    conn->cipherNs += conn->stageStart - received;
+    conn->sending = 1;
+
+    conn->dataLen = conn->batchLen;
+    conn->dataSent = 0;
+    conn->remaining -= conn->batchLen;
+    nextBatch(conn);
+}
+
+// Gather pending output into iov: the rest of the control message, then the
+// ciphered data, which lives in the message chunks. Returns the number of
+// iovecs, 0 once nothing is pending.
+static int pendingOutput(struct connection *conn, struct iovec *iov) {
+    int count = 0;
+    if (conn->controlSent < conn->controlLen) {
+        iov[count].iov_base = conn->control + conn->controlSent;
+        iov[count].iov_len = conn->controlLen - conn->controlSent;
+        count++;
+    }
+
+    size_t skip = conn->dataSent;
+    for (size_t offset = 0; offset < conn->dataLen; offset += OTP_CHUNK_SIZE) {
+        size_t n = conn->dataLen - offset < OTP_CHUNK_SIZE ? conn->dataLen - offset : OTP_CHUNK_SIZE;
+        if (skip >= n) {
+            skip -= n;
+            continue;
+        }
+        iov[count].iov_base = conn->buffer + conn->stride * offset + skip;
+        iov[count].iov_len = n - skip;
+        skip = 0;
+        count++;
+    }
+    return count;
+}
+
+// Account for bytes of pending output the kernel has taken
+static void outputSent(struct connection *conn, size_t bytesSent) {
+    otpMetricsAdd(OTP_COUNTER_BYTES_OUT, bytesSent);
+    size_t controlPart = conn->controlLen - conn->controlSent;
+    if (bytesSent < controlPart) controlPart = bytesSent;
+    conn->controlSent += controlPart;
+    conn->dataSent += bytesSent - controlPart;
+
+    if (conn->controlSent == conn->controlLen && conn->dataSent == conn->dataLen) {
+        conn->controlLen = conn->controlSent = 0;
+        conn->dataLen = conn->dataSent = 0;
+    }
+}
+
+// Send as much pending output as the socket takes. Returns 1 when all of it
+// is out, 0 if the socket is full, -1 on error.
+static int flushOutput(struct connection *conn) {
+    while (1) {
+        struct iovec iov[OUTPUT_IOVECS];
+        int count = pendingOutput(conn, iov);
+        if (count == 0) return 1;
+
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+        ssize_t bytesSent = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        if (bytesSent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        outputSent(conn, bytesSent);
+    }
+}
+
+// Called once all pending output has been handed to the kernel, before
+// reading more input
+static void outputFlushed(struct connection *conn) {
+    // A sent batch ends its send stage and starts the receive of the next;
+    // the job is done once its last batch is out
+    if (conn->sending) {
+        uint64_t sent = otpMetricsNow();
+        conn->sendNs += sent - conn->stageStart;
+        conn->stageStart = sent;
+        conn->sending = 0;
+    }
+    if (conn->jobActive && conn->remaining == 0) {
+        conn->jobActive = 0;
+        conn->large = 0;
+        releaseAdmitted(conn);
+        otpMetricsAdd(OTP_COUNTER_JOBS, 1);
+        otpMetricsRecord(OTP_STAGE_RECEIVE, conn->receiveNs);
+        otpMetricsRecord(OTP_STAGE_CIPHER, conn->cipherNs);
+        otpMetricsRecord(OTP_STAGE_SEND, conn->sendNs);
+        otpMetricsRecord(OTP_STAGE_JOB, otpMetricsNow() - conn->jobStart);
+    }
+
+    if (conn->closeAfterFlush) {
+        // Closing with unread input would reset the connection, and the
+        // client could lose the response before reading it. Read and drop
+        // whatever it still sends until it closes instead.
+        shutdown(conn->fd, SHUT_WR);
+        conn->closeAfterFlush = 0;
+        conn->state = CONN_DRAIN;
+    }
+
+    // Between jobs the buffer goes back to the pool, so idle connections
+    // hold none
+    if (conn->buffer && conn->state != CONN_PAYLOAD) releaseBuffer(conn);
+}
+
+// Where the input the current state is waiting for goes, and how much of it
+// is still missing
+static void inputTarget(struct connection *conn, char **target, size_t *want) {
+    switch (conn->state) {
+    case CONN_HANDSHAKE:
+        *target = conn->handshake + conn->got;
+        *want = OTP_HANDSHAKE_SIZE - conn->got;
+        break;
+    case CONN_HEADER:
+        *target = (char *)conn->header + conn->got;
+        *want = OTP_REQUEST_SIZE - conn->got;
+        break;
+    case CONN_KEY_REF:
+        *target = (char *)conn->keyRef + conn->got;
+        *want = OTP_KEY_REF_SIZE - conn->got;
+        break;
+    case CONN_PAYLOAD:
+        *target = conn->buffer + conn->got;
+        *want = conn->stride * conn->batchLen - conn->got;
+        break;
+    case CONN_DISCARD:
+        *target = discardBuffer;
+        *want = conn->discard < sizeof(discardBuffer) ? conn->discard : sizeof(discardBuffer);
+        break;
+    default:
+        *target = discardBuffer;
+        *want = sizeof(discardBuffer);
+        break;
+    }
+}
+
+// Account for input received into the current target, advancing the state
+// once it is complete. 0 bytes means the client closed the connection.
+// Returns -1 if the connection should be dropped.
+static int inputReceived(struct connection *conn, size_t bytesReceived) {
+    if (bytesReceived == 0) {
+        // Client closed connection; only an error if it was mid-job
+        if ((conn->state != CONN_HEADER || conn->got > 0) && conn->state != CONN_DRAIN) {
+            fprintf(stderr, "SERVER: Client closed connection mid-message\n");
+        }
+        return -1;
+    }
+
+    otpMetricsAdd(OTP_COUNTER_BYTES_IN, bytesReceived);
+    if (conn->state == CONN_HEADER && conn->got == 0) conn->jobStart = otpMetricsNow();
+    conn->got += bytesReceived;
+    switch (conn->state) {
+    case CONN_HANDSHAKE:
+        if (conn->got == OTP_HANDSHAKE_SIZE) return handleHandshake(conn);
+        break;
+    case CONN_HEADER:
+        if (conn->got == OTP_REQUEST_SIZE) return handleHeader(conn);
+        break;
+    case CONN_KEY_REF:
+        if (conn->got == OTP_KEY_REF_SIZE) return handleKeyRef(conn);
+        break;
+    case CONN_PAYLOAD:
+        if (conn->got == conn->stride * conn->batchLen) handleBatch(conn);
+        break;
+    case CONN_DISCARD:
+        conn->discard -= bytesReceived;
+        nextBatch(conn);
+        break;
+    case CONN_DRAIN:
+        break;
+    }
+    return 0;
+}
+
+// Make as much progress as possible on a connection. New input is only read
+// once earlier output has been handed to the kernel, which bounds the memory
+// a connection holds and pushes back on clients that don't read replies.
+// Returns -1 if the connection was closed, 1 if a large job stopped after a
+// batch and should be driven again later, 0 once the socket would block.
+static int driveConnection(struct connection *conn) {
+    int batched = 0;
+    while (1) {
+        int flushed = flushOutput(conn);
+        if (flushed < 0) return -1;
+        if (flushed == 0) return 0; // wait for EPOLLOUT
+        outputFlushed(conn);
+        if (batched && conn->large) return 1;
+
+        char *target;
+        size_t want;
+        inputTarget(conn, &target, &want);
+        ssize_t bytesReceived = recv(conn->fd, target, want, 0);
+        if (bytesReceived < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0; // wait for EPOLLIN
+            return -1;
+        }
+        if (inputReceived(conn, bytesReceived) < 0) return -1;
+        if (conn->sending) batched = 1;
+    }
+}
+
+static void serveConnection(struct connection *conn) {
+    int driven = driveConnection(conn);
+    if (driven < 0) closeConnection(conn);
+    else if (driven > 0) queueLarge(conn);
+}
+
+// Set up a connection of size bytes (at least a struct connection) for a
+// newly accepted socket. Closes the socket and returns NULL on failure.
+static struct connection *newConnection(int connectionSocket, size_t size) {
+    // Jobs are small header/response exchanges on a long-lived connection,
+    // so don't let Nagle hold them back
+    if (!serverConfig->unixPath) {
+        int one = 1;
+        setsockopt(connectionSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    struct connection *conn = calloc(1, size);
+    if (!conn) {
+        close(connectionSocket);
+        return NULL;
+    }
+    conn->fd = connectionSocket;
+    conn->state = CONN_HANDSHAKE;
+    conn->acceptedAt = otpMetricsNow();
+    otpMetricsAdd(OTP_COUNTER_ACCEPTED, 1);
+    otpMetricsRecord(OTP_STAGE_ACCEPT_WAIT, conn->acceptedAt - loopWoke);
+    return conn;
+}
+
+static void acceptConnections(int listenSocket, int epollFD) {
+    while (1) {
+        int connectionSocket = accept4(listenSocket, NULL, NULL, SOCK_NONBLOCK);
+        if (connectionSocket < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("ERROR on accept");
+            return;
+        }
+
+        struct connection *conn = newConnection(connectionSocket, sizeof(*conn));
+        if (!conn) continue;
+
+        // Edge triggered: driveConnection() always runs until the socket
+        // would block, so every later edge is a real change
+        struct epoll_event event = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+            .data.ptr = conn,
+        };
+        if (epoll_ctl(epollFD, EPOLL_CTL_ADD, connectionSocket, &event) < 0) {
+            perror("ERROR adding connection to epoll");
+            closeConnection(conn);
+        }
+    }
+}
+
+#if OTP_HAVE_IO_URING
+
+// The io_uring engine drives the same connection state machine with
+// completions instead of readiness. A connection has at most one operation
+// in flight, a send of its pending output or a receive into its input
+// target, so output still goes out before more input is read. Completions
+// carry the connection pointer, with the low bit set for sends; the listen
+// socket and the pool trim timer use small values no pointer can have.
+#define RING_ENTRIES 1024
+#define RING_ACCEPT 2
+#define RING_TIMER 4
+#define RING_SEND 1
+
+// Small-job buffers registered with the ring, so payload reads into them
+// skip mapping the user pages on every call
+#define RING_FIXED_BUFFERS 64
+
+struct ringConnection {
+    struct connection conn; // first, so closeConnection() frees it all
+    struct msghdr msg;
+    struct iovec iov[OUTPUT_IOVECS];
+
+    // Completion held back while the connection waits in the large lane
+    int laneSend;
+    int laneResult;
+};
+
+static struct otpRing ring;
+static int ringMultishotAccept = 1;
+static char *ringFixed;
+static size_t ringFixedLen;
+static struct __kernel_timespec ringTrimInterval = {
+    .tv_sec = POOL_TRIM_INTERVAL_MS / 1000,
+    .tv_nsec = POOL_TRIM_INTERVAL_MS % 1000 * 1000000L,
+};
+
+// Everything queued here goes to the kernel in one io_uring_enter() per
+// pass of the event loop
+static struct io_uring_sqe *ringSqe(void) {
+    struct io_uring_sqe *sqe;
+    while (!(sqe = otpRingGetSqe(&ring))) otpRingSubmit(&ring, 0);
+    return sqe;
+}
+
+// A multishot accept keeps producing connections until the kernel ends it
+static void ringAccept(int listenSocket) {
+    struct io_uring_sqe *sqe = ringSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenSocket;
+    if (ringMultishotAccept) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = RING_ACCEPT;
+}
+
+static void ringTimer(void) {
+    struct io_uring_sqe *sqe = ringSqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)&ringTrimInterval;
+    sqe->len = 1;
+    sqe->user_data = RING_TIMER;
+}
+
+// Queue the connection's next operation
+static void ringDrive(struct ringConnection *rc) {
+    struct connection *conn = &rc->conn;
+    struct io_uring_sqe *sqe = ringSqe();
+    sqe->fd = conn->fd;
+
+    int count = pendingOutput(conn, rc->iov);
+    if (count > 0) {
+        memset(&rc->msg, 0, sizeof(rc->msg));
+        rc->msg.msg_iov = rc->iov;
+        rc->msg.msg_iovlen = count;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = (uintptr_t)&rc->msg;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = (uintptr_t)rc | RING_SEND;
+        return;
+    }
+    outputFlushed(conn);
+
+    char *target;
+    size_t want;
+    inputTarget(conn, &target, &want);
+    sqe->opcode = IORING_OP_RECV;
+    if (ringFixed && target >= ringFixed && target + want <= ringFixed + ringFixedLen) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->off = (uint64_t)-1;
+        sqe->buf_index = 0;
+    }
+    sqe->addr = (uintptr_t)target;
+    sqe->len = want;
+    sqe->user_data = (uintptr_t)rc;
+}
+
+static void ringCompleted(struct ringConnection *rc, int send, int result) {
+    struct connection *conn = &rc->conn;
+    if (result == -EINTR || result == -EAGAIN) {
+        ringDrive(rc);
+        return;
+    }
+    if (result < 0) {
+        closeConnection(conn);
+        return;
+    }
+    if (send) {
+        outputSent(conn, result);
+    } else if (inputReceived(conn, result) < 0) {
+        closeConnection(conn);
+        return;
+    }
+    ringDrive(rc);
+}
+
+static void ringAccepted(int listenSocket, int result, unsigned flags) {
+    if (result >= 0) {
+        // Sockets stay blocking: the ring waits for them, not the worker
+        struct connection *conn = newConnection(result, sizeof(struct ringConnection));
+        if (conn) ringDrive((struct ringConnection *)conn);
+    } else if (result == -EINVAL && ringMultishotAccept) {
+        // Kernels before 5.19 only accept one connection per request
+        ringMultishotAccept = 0;
+    } else if (result == -EINVAL) {
+        // Not a passing failure: asking again would fail the same way at
+        // once, forever
+        fprintf(stderr, "ERROR on accept: %s; worker stops accepting\n", strerror(-result));
+        return;
+    } else if (result != -EINTR && result != -ECONNABORTED && result != -EAGAIN) {
+        fprintf(stderr, "ERROR on accept: %s\n", strerror(-result));
+    }
+    if (!(flags & IORING_CQE_F_MORE)) ringAccept(listenSocket);
+}
+
+// Serve connections through io_uring. Only returns if the kernel has no
+// usable io_uring, before anything has been set up.
+static void runWorkerUring(int listenSocket) {
+    if (otpRingInit(&ring, RING_ENTRIES) < 0) {
+        fprintf(stderr, "SERVER: io_uring unavailable (%s), using epoll\n", strerror(errno));
+        return;
+    }
+
+    otpPoolInit(POOL_CAP);
+    ringFixed = otpPoolArena(RING_FIXED_BUFFERS, &ringFixedLen);
+    if (ringFixed) {
+        struct iovec fixed = { .iov_base = ringFixed, .iov_len = ringFixedLen };
+        int registered = otpRingRegisterBuffers(&ring, &fixed, 1);
+        if (registered < 0) {
+            // Usually RLIMIT_MEMLOCK; the buffers still serve plain receives
+            fprintf(stderr, "SERVER: Could not register io_uring buffers: %s\n", strerror(-registered));
+            ringFixed = NULL;
+        }
+    }
+
+    ringAccept(listenSocket);
+    ringTimer();
+    while (1) {
+        int submitted = otpRingSubmit(&ring, 1);
+        if (submitted < 0 && submitted != -EBUSY) {
+            fprintf(stderr, "ERROR in io_uring_enter: %s\n", strerror(-submitted));
+            exit(1);
+        }
+        loopWoke = otpMetricsNow();
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = otpRingPeek(&ring))) {
+            uint64_t data = cqe->user_data;
+            int result = cqe->res;
+            unsigned flags = cqe->flags;
+            otpRingAdvance(&ring);
+
+            if (data == RING_ACCEPT) {
+                ringAccepted(listenSocket, result, flags);
+            } else if (data == RING_TIMER) {
+                otpPoolTrim();
+                ringTimer();
+            } else {
+                struct ringConnection *rc = (struct ringConnection *)(uintptr_t)(data & ~(uint64_t)RING_SEND);
+                if (rc->conn.large) {
+                    rc->laneSend = data & RING_SEND;
+                    rc->laneResult = result;
+                    queueLarge(&rc->conn);
+                } else {
+                    ringCompleted(rc, data & RING_SEND, result);
+                }
+            }
+        }
+
+        // Large jobs go last: the small jobs' operations are handed to the
+        // kernel before any large batch is ciphered
+        if (laneHead) otpRingSubmit(&ring, 0);
+        while (laneHead) {
+            struct ringConnection *rc = (struct ringConnection *)nextLarge();
+            ringCompleted(rc, rc->laneSend, rc->laneResult);
+        }
+    }
+}
+
+#else
+
+static void runWorkerUring(int listenSocket) {
+    (void)listenSocket;
+    fprintf(stderr, "SERVER: Built without io_uring, using epoll\n");
+}
+
+#endif
+
+static void runWorker(int listenSocket, int shared) {
+    if (serverConfig->ioUring) runWorkerUring(listenSocket);
+
+    int epollFD = epoll_create1(0);
+    if (epollFD < 0) {
+        perror("ERROR creating epoll instance");
+        exit(1);
+    }
+
+    // On a listen socket shared by all workers, EPOLLEXCLUSIVE wakes one
+    // worker per incoming connection instead of all of them
+    struct epoll_event listenEvent = { .events = EPOLLIN, .data.ptr = NULL };
+    if (shared) listenEvent.events |= EPOLLEXCLUSIVE;
+    if (epoll_ctl(epollFD, EPOLL_CTL_ADD, listenSocket, &listenEvent) < 0) {
+        perror("ERROR adding listen socket to epoll");
+        exit(1);
+    }
+
+    otpPoolInit(POOL_CAP);
+    struct timespec lastTrim;
+    clock_gettime(CLOCK_MONOTONIC, &lastTrim);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        // Large jobs waiting their turn may have input already, so only
+        // poll for more while they do
+        int ready = epoll_wait(epollFD, events, MAX_EVENTS, laneHead ? 0 : POOL_TRIM_INTERVAL_MS);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("ERROR in epoll_wait");
+            exit(1);
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        loopWoke = otpMetricsNow();
+        long elapsedMs = (now.tv_sec - lastTrim.tv_sec) * 1000 + (now.tv_nsec - lastTrim.tv_nsec) / 1000000;
+        if (elapsedMs >= POOL_TRIM_INTERVAL_MS) {
+            otpPoolTrim();
+            lastTrim = now;
+        }
+
+        // Small jobs run to completion as their sockets allow. A large job
+        // gets a batch per pass, then joins the large lane; a connection in
+        // the lane is only driven from there.
+        for (int i = 0; i < ready; i++) {
+            struct connection *conn = events[i].data.ptr;
+            if (!conn) {
+                acceptConnections(listenSocket, epollFD);
+            } else if (!conn->queued) {
+                serveConnection(conn);
+            }
+        }
+        struct connection *last = laneTail;
+        while (last) {
+            struct connection *conn = nextLarge();
+            int end = conn == last;
+            serveConnection(conn);
+            if (end) break;
+        }
+    }
+}
+
+// Whether the socket at address is left over from a server that is gone.
+// Only a refused connection says so; a connection, or a full backlog, means
+// someone is still listening.
+static int unixSocketStale(const struct sockaddr_un *address, socklen_t addressLength) {
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (probe < 0) return 0;
+    int stale = connect(probe, (const struct sockaddr*)address, addressLength) < 0 && errno == ECONNREFUSED;
+    close(probe);
+    return stale;
+}
+
+static int openUnixListenSocket(const char *path, int backlog) {
+    struct sockaddr_un address;
+    socklen_t addressLength;
+    if (otpUnixAddress(path, &address, &addressLength) < 0) {
+        fprintf(stderr, "ERROR: socket name too long: %s\n", path);
+        return -1;
+    }
+
+    int listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listenSocket < 0) {
+        perror("ERROR opening socket");
+        return -1;
+    }
+
+    // A socket file left by an earlier run would make bind() fail. It is
+    // removed only when nothing answers on it: a live server's socket, or
+    // anything at the path that is not a socket, is not ours to remove.
+    struct stat st;
+    if (path[0] == '/' && lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode) || !unixSocketStale(&address, addressLength)) {
+            errno = EADDRINUSE;
+            perror(path);
+            close(listenSocket);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if (bind(listenSocket, (struct sockaddr*)&address, addressLength) < 0) {
+        perror("ERROR on binding");
+        close(listenSocket);
+        return -1;
+    }
+
+    if (listen(listenSocket, backlog) < 0) {
+        perror("ERROR on listen");
+        close(listenSocket);
+        return -1;
+    }
+    return listenSocket;
+}
+
+static int openListenSocket(const struct otpServerConfig *config) {
+    if (config->unixPath) return openUnixListenSocket(config->unixPath, config->backlog);
+
+    int listenSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listenSocket < 0) {
+        perror("ERROR opening socket");
+        return -1;
+    }
+
+    if (config->reusePort) {
+        int one = 1;
+        if (setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+            perror("ERROR setting SO_REUSEPORT");
+            close(listenSocket);
+            return -1;
+        }
+    }
+
+    struct sockaddr_in serverAddress;
+    setupAddressStruct(&serverAddress, config->port);
+
+    if (bind(listenSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) {
+        perror("ERROR on binding");
+        close(listenSocket);
+        return -1;
+    }
+
+    if (listen(listenSocket, config->backlog) < 0) {
+        perror("ERROR on listen");
+        close(listenSocket);
+        return -1;
+    }
+    return listenSocket;
+}
+
+// Parse a TCP port, 1 to 65535. Returns -1 on error.
+static int parsePort(const char *text) {
+    char *end;
+    errno = 0;
+    long port = strtol(text, &end, 10);
+    if (errno || end == text || *end != '\0' || port < 1 || port > 65535) return -1;
+    return (int)port;
+}
+
+// The stats socket is local: a Unix domain socket, or a TCP port on the
+// loopback address only. The parent accepts on it in blocking mode.
+static int openStatsSocket(const char *address) {
+    int statsSocket;
+    if (otpIsUnixAddress(address)) {
+        statsSocket = openUnixListenSocket(address, SOMAXCONN);
+        if (statsSocket < 0) return -1;
+        fcntl(statsSocket, F_SETFL, fcntl(statsSocket, F_GETFL) & ~O_NONBLOCK);
+        return statsSocket;
+    }
+
+    statsSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (statsSocket < 0) {
+        perror("ERROR opening stats socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(statsSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in statsAddress;
+    setupAddressStruct(&statsAddress, parsePort(address));
+    statsAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(statsSocket, (struct sockaddr*)&statsAddress, sizeof(statsAddress)) < 0 ||
+        listen(statsSocket, SOMAXCONN) < 0) {
+        perror("ERROR on stats socket");
+        close(statsSocket);
+        return -1;
+    }
+    return statsSocket;
+}
+
+// Answer every connection to the stats socket with the metrics, as an
+// HTTP/1.0 response so Prometheus and curl can read it. Whatever request
+// the client sends is read and ignored.
+static void serveStats(int statsSocket) {
+    while (1) {
+        int client = accept(statsSocket, NULL, NULL);
+        if (client < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) perror("ERROR on stats accept");
+            continue;
+        }
+
+        // A stuck scraper must not hold up the next one for long
+        struct timeval timeout = { .tv_sec = 1 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        char request[2048];
+        size_t got = 0;
+        while (got < sizeof(request) - 1) {
+            ssize_t n = recv(client, request + got, sizeof(request) - 1 - got, 0);
+            if (n <= 0) break;
+            got += n;
+            request[got] = '\0';
+            if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+        }
+
+        size_t len;
+        char *text = otpMetricsText(&len);
+        if (text) {
+            char header[256];
+            int headerLen = snprintf(header, sizeof(header),
+                                     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+            struct iovec iov[2] = { { header, headerLen }, { text, len } };
+            struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+            sendmsg(client, &msg, MSG_NOSIGNAL);
+            free(text);
+        }
+        close(client);
+    }
+}
+
+// Pin the calling worker to the index-th CPU it is allowed to run on
+static void pinWorker(int index) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        perror("sched_getaffinity");
+        return;
+    }
+
+    int count = CPU_COUNT(&allowed);
+    int target = index % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed) || target-- > 0) continue;
+
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        if (sched_setaffinity(0, sizeof(one), &one) < 0) {
+            perror("sched_setaffinity");
+        }
+        return;
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "USAGE: %s [-w workers] [-t threads] [-b backlog] [-k keydir] [--no-reuseport] [--pin] [--io-uring] [--stats port|/path|@name] [--max-message N] [--budget N] [--conn-budget N] [--large-job N] port|/path|@name\n", program);
+    fprintf(stderr, "  -w, --workers N     worker processes (default: online CPUs, or online\n");
+    fprintf(stderr, "                      CPUs / %d when -t is not given either)\n", DEFAULT_WORKER_THREADS);
+    fprintf(stderr, "  -t, --threads N     cipher threads per worker for jobs of 4 MiB or more\n");
+    fprintf(stderr, "                      (default: online CPUs / workers, at least 1)\n");
+    fprintf(stderr, "  By default the workers and their cipher threads add up to the online CPUs,\n");
+    fprintf(stderr, "  with up to %d threads ciphering each large job.\n", DEFAULT_WORKER_THREADS);
+    fprintf(stderr, "  -b, --backlog N     listen backlog per socket (default: %d)\n", SOMAXCONN);
+    fprintf(stderr, "  -k, --key-dir DIR   serve the pads DIR/<id>.key to clients that name them\n");
+    fprintf(stderr, "      --no-reuseport  share one listen socket instead of one per worker\n");
+    fprintf(stderr, "      --pin           pin each worker to its own CPU\n");
+    fprintf(stderr, "      --io-uring      use io_uring where the kernel supports it, else epoll\n");
+    fprintf(stderr, "      --stats ADDR    serve Prometheus metrics on a local port or Unix socket\n");
+    fprintf(stderr, "      --max-message N reject messages longer than N bytes\n");
+    fprintf(stderr, "      --budget N      message bytes in flight across all workers before\n");
+    fprintf(stderr, "                      new requests are answered busy\n");
+    fprintf(stderr, "      --conn-budget N most bytes of batch buffer one connection holds\n");
+    fprintf(stderr, "      --large-job N   messages of N bytes or more yield to smaller ones\n");
+    fprintf(stderr, "                      (default: 4M, 0 for one lane)\n");
+    fprintf(stderr, "  Sizes take a K, M or G suffix.\n");
+}
+
+// Parse a byte count with an optional K, M or G (binary) suffix. Returns -1
+// on error.
+static int parseBytes(const char *text, uint64_t *value) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (errno || end == text || text[0] == '-') return -1;
+    int shift = 0;
+    switch (*end) {
+    case 'K': case 'k': shift = 10; end++; break;
+    case 'M': case 'm': shift = 20; end++; break;
+    case 'G': case 'g': shift = 30; end++; break;
+    }
+    if (*end != '\0' || n > UINT64_MAX >> shift) return -1;
+    *value = (uint64_t)n << shift;
+    return 0;
+}
+
+int otpParseServerArgs(int argc, char *argv[], struct otpServerConfig *config) {
+    static const struct option options[] = {
+        { "workers", required_argument, NULL, 'w' },
+        { "threads", required_argument, NULL, 't' },
+        { "backlog", required_argument, NULL, 'b' },
+        { "key-dir", required_argument, NULL, 'k' },
+        { "no-reuseport", no_argument, NULL, 'R' },
+        { "pin", no_argument, NULL, 'P' },
+        { "io-uring", no_argument, NULL, 'U' },
+        { "stats", required_argument, NULL, 'S' },
+        { "max-message", required_argument, NULL, 'M' },
+        { "budget", required_argument, NULL, 'G' },
+        { "conn-budget", required_argument, NULL, 'C' },
+        { "large-job", required_argument, NULL, 'L' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    config->workers = 0;
+    config->threads = 0; // both set from the CPU count once options are known
+    config->backlog = SOMAXCONN;
+    config->reusePort = 1;
+    config->pinWorkers = 0;
+    config->ioUring = 0;
+    config->statsAddress = NULL;
+    config->keyDir = NULL;
+    config->maxMessage = 0;
+    config->budget = 0;
+    config->connectionBudget = 0;
+    config->largeJob = OTP_PARALLEL_THRESHOLD;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "w:t:b:k:", options, NULL)) != -1) {
+        switch (opt) {
+        case 'w':
+            config->workers = atoi(optarg);
+            if (config->workers < 1) config->workers = -1;
+            break;
+        case 't':
+            config->threads = atoi(optarg);
+            if (config->threads < 1) config->threads = -1;
+            break;
+        case 'b':
+            config->backlog = atoi(optarg);
+            break;
+        case 'k':
+            config->keyDir = optarg;
+            break;
+        case 'R':
+            config->reusePort = 0;
+            break;
+        case 'P':
+            config->pinWorkers = 1;
+            break;
+        case 'U':
+            config->ioUring = 1;
+            break;
+        case 'S':
+            if (!otpIsUnixAddress(optarg) && parsePort(optarg) < 0) {
+                fprintf(stderr, "%s: bad stats port '%s'\n", argv[0], optarg);
+                usage(argv[0]);
+                return -1;
+            }
+            config->statsAddress = optarg;
+            break;
+        case 'M':
+        case 'G':
+        case 'C':
+        case 'L': {
+            uint64_t value;
+            if (parseBytes(optarg, &value) < 0) {
+                fprintf(stderr, "%s: bad size '%s'\n", argv[0], optarg);
+                usage(argv[0]);
+                return -1;
+            }
+            if (opt == 'M') config->maxMessage = value;
+            else if (opt == 'G') config->budget = value;
+            else if (opt == 'L') config->largeJob = value;
+            else config->connectionBudget = value > SIZE_MAX ? SIZE_MAX : (size_t)value;
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    // Every worker runs its own cipher pool, so by default the pools split
+    // the CPUs between them rather than each taking all of them. With
+    // neither count given, fewer workers leave each pool several threads so
+    // large jobs still fan out.
+    if (config->workers == 0) {
+        config->workers = cpus;
+        if (config->threads == 0 && cpus / DEFAULT_WORKER_THREADS > 1) {
+            config->workers = (int)(cpus / DEFAULT_WORKER_THREADS);
+        } else if (config->threads == 0) {
+            config->workers = 1;
+        }
+    }
+    if (config->threads == 0 && config->workers > 0) {
+        config->threads = cpus / config->workers > 1 ? (int)(cpus / config->workers) : 1;
+    }
+    if (optind != argc - 1 || config->workers < 1 || config->threads < 1 || config->backlog < 1) {
+        usage(argv[0]);
+        return -1;
+    }
+    // Unix domain sockets have no SO_REUSEPORT balancing; the workers share
+    // one listen socket instead
+    config->unixPath = NULL;
+    config->port = 0;
+    if (otpIsUnixAddress(argv[optind])) {
+        config->unixPath = argv[optind];
+        config->reusePort = 0;
+    } else if ((config->port = parsePort(argv[optind])) < 0) {
+        fprintf(stderr, "%s: bad port '%s'\n", argv[0], argv[optind]);
+        usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+void otpServe(const struct otpServerConfig *config) {
+    serverConfig = config;
+
+    struct sigaction sa;
+    sa.sa_handler = handle_sigchld;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGCHLD, &sa, NULL) == -1) {
+        perror("sigaction");
+        return;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // Pads are mapped before forking so every worker shares the mappings.
+    // Only encryption reserves ranges, so only it needs the ledgers.
+    if (config->keyDir) {
+        int keys = otpKeyStoreOpen(config->keyDir, (config->ops & OTP_OP_BIT(OTP_OP_ENCRYPT)) != 0);
+        if (keys < 0) return;
+        fprintf(stderr, "SERVER: Serving %d key(s) from %s\n", keys, config->keyDir);
+    }
+
+    // With SO_REUSEPORT every worker gets its own listen socket and the
+    // kernel spreads incoming connections across them. All sockets are bound
+    // up front so a bad port fails before anything is forked.
+    int socketCount = config->reusePort ? config->workers : 1;
+    int *listenSockets = malloc(socketCount * sizeof(*listenSockets));
+    if (!listenSockets) {
+        perror("malloc");
+        return;
+    }
+    for (int i = 0; i < socketCount; i++) {
+        listenSockets[i] = openListenSocket(config);
+        if (listenSockets[i] < 0) return;
+    }
+
+    // The in-flight budget is one counter every worker adds its jobs to,
+    // followed by each worker's own share of it
+    if (config->budget) {
+        size_t counters = 1 + (size_t)config->workers;
+        inFlightBytes = mmap(NULL, counters * sizeof(*inFlightBytes), PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        workerPids = calloc(config->workers, sizeof(*workerPids));
+        if (inFlightBytes == MAP_FAILED || !workerPids) {
+            perror("ERROR setting up the budget");
+            return;
+        }
+        workerInFlight = inFlightBytes + 1;
+    }
+
+    // Workers write their metrics into shared slots the parent serves
+    int statsSocket = -1;
+    if (config->statsAddress) {
+        if (otpMetricsInit(config->workers) < 0) return;
+        statsSocket = openStatsSocket(config->statsAddress);
+        if (statsSocket < 0) return;
+    }
+
+    // Create process pool; each child multiplexes its own connections.
+    // SIGCHLD waits until every pid is recorded, so a worker that dies early
+    // is still matched to its budget share.
+    sigset_t sigchld, unblocked;
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &sigchld, &unblocked);
+    for (int i = 0; i < config->workers; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("ERROR on fork");
+            return;
+        }
+
+        if (pid == 0) {
+            sigprocmask(SIG_SETMASK, &unblocked, NULL);
+            if (workerInFlight) ownInFlight = &workerInFlight[i];
+            int mine = config->reusePort ? i : 0;
+            for (int j = 0; j < socketCount; j++) {
+                if (j != mine) close(listenSockets[j]);
+            }
+
+            // The cipher helpers start before the worker is pinned, so they
+            // keep the whole CPU set instead of sharing the worker's core
+            if (otpParallelInit(config->threads) < 0) {
+                fprintf(stderr, "SERVER: ERROR: could not start all cipher threads, ciphering large jobs with %d\n",
+                        otpParallelThreads());
+            } else if (i == 0) {
+                fprintf(stderr, "SERVER: %d worker(s), ciphering large jobs with %d thread(s) each\n",
+                        config->workers, otpParallelThreads());
+            }
+            if (config->pinWorkers) pinWorker(i);
+            if (statsSocket >= 0) close(statsSocket);
+            otpMetricsSelect(i);
+
+            runWorker(listenSockets[mine], !config->reusePort);
+            exit(0);
+        }
+        // Parent continues to next fork
+        if (workerPids) workerPids[i] = pid;
+    }
+    sigprocmask(SIG_SETMASK, &unblocked, NULL);
+
+    // The parent has no use for the listen sockets; the workers own them
+    for (int i = 0; i < socketCount; i++) {
+        close(listenSockets[i]);
+    }
+    free(listenSockets);
+
+    // Parent process answers scrapes, or just waits forever
+    if (statsSocket >= 0) serveStats(statsSocket);
+    while (1) pause();
+}
@@ -0,0 +1,53 @@
+#ifndef OTP_SERVER_H
+#define OTP_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Server configuration
+struct otpServerConfig {
+    // Operations served, a set of OTP_OP_BIT()s: one for enc_server and
+    // dec_server, OTP_OPS_ALL for otp_d. Clients whose handshake allows none
+    // of them are turned away.
+    unsigned ops;
+
+    // Filled in from the command line by otpParseServerArgs()
+    int port;
+    const char *unixPath; // Unix domain socket to listen on instead, or NULL
+    int workers;    // worker processes, defaults to the online CPUs, or a
+                    // quarter of them when threads isn't given either
+    int threads;    // cipher threads per worker for large jobs, defaults to
+                    // the online CPUs divided among the workers
+    int backlog;    // listen() backlog of each listen socket
+    int reusePort;  // one SO_REUSEPORT listen socket per worker
+    int pinWorkers; // pin worker i to the i-th CPU the server may use
+    int ioUring;    // serve connections through io_uring when the kernel has it
+    const char *statsAddress; // local port, /path or @name for Prometheus metrics, or NULL
+    const char *keyDir; // directory of <id>.key pads clients may refer to, or NULL
+
+    // Limits, 0 for none. Requests over maxMessage bytes are rejected as too
+    // large. Once jobs holding budget message bytes are in flight across all
+    // workers, new requests are answered busy until some finish.
+    // connectionBudget caps the batch buffer one connection holds.
+    uint64_t maxMessage;
+    uint64_t budget;
+    size_t connectionBudget;
+
+    // Jobs of at least largeJob message bytes are scheduled behind smaller
+    // ones, or 0 to serve all jobs alike
+    uint64_t largeJob;
+};
+
+// Parse "[-w workers] [-t threads] [-b backlog] [-k keydir] [--no-reuseport]
+// [--pin] [--io-uring] [--stats port|/path|@name] [--max-message N]
+// [--budget N] [--conn-budget N] [--large-job N] port|/path|@name"
+// into config. Prints usage and returns -1 on bad arguments.
+int otpParseServerArgs(int argc, char *argv[], struct otpServerConfig *config);
+
+// Listen on config->port or config->unixPath and serve clients forever.
+// Each worker process runs an epoll loop over nonblocking connections, or
+// with config->ioUring an io_uring completion loop, so one slow client never
+// holds up the others. Only returns on a setup error, after printing it.
+void otpServe(const struct otpServerConfig *config);
+
+#endif
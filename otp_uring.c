@@ -0,0 +1,148 @@
+#include "otp_uring.h"
+
+#if OTP_HAVE_IO_URING
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Operations the servers queue. Kernels that can set up a ring may still
+// lack some of them (accept arrived in 5.5, recv in 5.6), and would fail
+// every one with -EINVAL.
+static const unsigned char requiredOps[] = {
+    IORING_OP_ACCEPT,
+    IORING_OP_RECV,
+    IORING_OP_SENDMSG,
+    IORING_OP_READ_FIXED,
+    IORING_OP_TIMEOUT,
+};
+
+// Whether the kernel supports every required operation. Kernels before 5.6
+// have no probe, and none of them has recv either.
+static int probeOps(int fd) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe) return 0;
+
+    int supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; supported && i < sizeof(requiredOps); i++) {
+        unsigned op = requiredOps[i];
+        supported = op <= probe->last_op && op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+int otpRingInit(struct otpRing *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) return -1;
+    if (!probeOps(fd)) {
+        close(fd);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) goto fail;
+    ring->cqRing = ring->sqRing;
+    if (!single) {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            fd, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED) goto fail;
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto fail;
+
+    char *sq = ring->sqRing;
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->sqTailLocal = *ring->sqTail;
+
+    char *cq = ring->cqRing;
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    ring->fd = fd;
+    return 0;
+
+fail:
+    {
+        int saved = errno;
+        if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqesSize);
+        if (ring->cqRing && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+            munmap(ring->cqRing, ring->cqRingSize);
+        }
+        if (ring->sqRing && ring->sqRing != MAP_FAILED) munmap(ring->sqRing, ring->sqRingSize);
+        close(fd);
+        errno = saved;
+    }
+    return -1;
+}
+
+struct io_uring_sqe *otpRingGetSqe(struct otpRing *ring) {
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (ring->sqTailLocal - head > ring->sqMask) return NULL;
+
+    unsigned index = ring->sqTailLocal & ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ring->sqTailLocal++;
+    ring->toSubmit++;
+    return sqe;
+}
+
+int otpRingSubmit(struct otpRing *ring, unsigned waitFor) {
+    __atomic_store_n(ring->sqTail, ring->sqTailLocal, __ATOMIC_RELEASE);
+
+    unsigned flags = waitFor ? IORING_ENTER_GETEVENTS : 0;
+    while (1) {
+        int ret = (int)syscall(__NR_io_uring_enter, ring->fd, ring->toSubmit, waitFor, flags, NULL, 0);
+        if (ret >= 0) {
+            ring->toSubmit -= (unsigned)ret < ring->toSubmit ? (unsigned)ret : ring->toSubmit;
+            if (ring->toSubmit == 0 || !waitFor) return 0;
+            continue;
+        }
+        if (errno == EINTR) {
+            if (ring->toSubmit == 0) return 0;
+            continue;
+        }
+        return -errno;
+    }
+}
+
+struct io_uring_cqe *otpRingPeek(struct otpRing *ring) {
+    unsigned head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) return NULL;
+    return &ring->cqes[head & ring->cqMask];
+}
+
+void otpRingAdvance(struct otpRing *ring) {
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+int otpRingRegisterBuffers(struct otpRing *ring, const struct iovec *iov, unsigned count) {
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, count) < 0) return -errno;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef OTP_URING_H
+#define OTP_URING_H
+
+// A minimal io_uring submission/completion ring, driven through the raw
+// system calls so the servers need no liburing. OTP_HAVE_IO_URING is 0 when
+// the kernel headers lack io_uring; otpRingInit() then always fails and
+// callers fall back to epoll.
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define OTP_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifndef OTP_HAVE_IO_URING
+#define OTP_HAVE_IO_URING 0
+#endif
+
+#if OTP_HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+struct otpRing {
+    int fd;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned sqTailLocal; // entries queued, published on submit
+    unsigned toSubmit;
+
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+};
+
+// Set up a ring with room for entries submissions. Returns 0, or -1 with
+// errno set if io_uring is unavailable (old kernel, disabled, seccomp), or
+// EOPNOTSUPP if the kernel lacks an operation the servers use.
+int otpRingInit(struct otpRing *ring, unsigned entries);
+
+// A zeroed submission entry to fill in, or NULL if the ring is full (call
+// otpRingSubmit() and retry).
+struct io_uring_sqe *otpRingGetSqe(struct otpRing *ring);
+
+// Submit every queued entry in one system call, then wait until at least
+// waitFor completions are available. Returns 0 or -errno.
+int otpRingSubmit(struct otpRing *ring, unsigned waitFor);
+
+// The oldest unconsumed completion, or NULL; otpRingAdvance() consumes it
+struct io_uring_cqe *otpRingPeek(struct otpRing *ring);
+void otpRingAdvance(struct otpRing *ring);
+
+// Register buffers for IORING_OP_READ_FIXED/WRITE_FIXED. Returns 0 or
+// -errno (often -ENOMEM when the memlock limit is too low).
+int otpRingRegisterBuffers(struct otpRing *ring, const struct iovec *iov, unsigned count);
+
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+// Checks the vector cipher kernels against the table-driven scalar one.
+//
+//   otp_kernel_test KERNEL
+//
+// The kernel is picked once per process from OTP_KERNEL, so the test runs
+// itself twice, as "--dump" children with OTP_KERNEL=scalar and
+// OTP_KERNEL=KERNEL. Each child ciphers and validates the same generated
+// inputs, every length from 0 to 257 at every offset from 0 to 7 so the
+// vector loops see each tail length and unaligned spans, and writes all its
+// output to stdout. The two outputs must match byte for byte. Exits 77,
+// which ctest reports as skipped, when this CPU lacks KERNEL.
+
+#define _GNU_SOURCE // setenv()
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "otp_cipher.h"
+
+#define MAX_LEN 257
+#define MAX_OFFSET 8
+#define SKIPPED 77
+
+// Input patterns: which bytes may appear besides the alphabet
+enum pattern {
+    PLAIN,           // message and key all in the alphabet
+    NEWLINES,        // message newlines, which pass through
+    BAD_MESSAGE,     // message bytes outside the alphabet
+    BAD_KEY,         // key bytes outside the alphabet
+    PATTERN_COUNT,
+};
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ ";
+static const char outsiders[] = { 'a', 'z', '\0', '\t', '@', '[', '`', '{', (char)0x80, (char)0xFF };
+
+// xorshift64*, seeded the same in every child
+static uint64_t state = 0x6b65726e656cULL;
+
+static uint64_t nextRandom(void) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+static void fill(char *text, size_t len, int newlines, int bad) {
+    for (size_t i = 0; i < len; i++) {
+        uint64_t r = nextRandom();
+        if (newlines && r % 16 == 0) {
+            text[i] = '\n';
+        } else if (bad && r % 32 == 1) {
+            text[i] = outsiders[(r >> 8) % sizeof(outsiders)];
+        } else {
+            text[i] = alphabet[(r >> 16) % OTP_ALPHABET_SIZE];
+        }
+    }
+}
+
+static void writeAll(const void *data, size_t len) {
+    if (len > 0 && fwrite(data, 1, len, stdout) != len) exit(1);
+}
+
+// Child side: run every case under the kernel OTP_KERNEL picked and write
+// the kernel name, then all results, to stdout
+static int dump(void) {
+    static char messageBase[MAX_LEN + 2 * MAX_OFFSET];
+    static char keyBase[MAX_LEN + 2 * MAX_OFFSET];
+    static char outBase[MAX_LEN + 2 * MAX_OFFSET];
+
+    printf("%s\n", otpCipherKernel());
+    for (int pattern = 0; pattern < PATTERN_COUNT; pattern++) {
+        for (size_t len = 0; len <= MAX_LEN; len++) {
+            for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+                // The output is misaligned differently from the inputs
+                char *message = messageBase + offset;
+                char *key = keyBase + (offset + 3) % MAX_OFFSET;
+                char *out = outBase + (offset + 5) % MAX_OFFSET;
+                fill(message, len, pattern == NEWLINES, pattern == BAD_MESSAGE);
+                fill(key, len, 0, pattern == BAD_KEY);
+
+                otpEncrypt(out, message, key, len);
+                writeAll(out, len);
+                otpDecrypt(out, message, key, len);
+                writeAll(out, len);
+
+                size_t span = otpTextSpan(message, len);
+                writeAll(&span, sizeof(span));
+
+                // In place, where the output aliases the message
+                otpEncryptInPlace(message, key, len);
+                writeAll(message, len);
+                otpDecryptInPlace(message, key, len);
+                writeAll(message, len);
+            }
+        }
+    }
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+// Run this program as a child with OTP_KERNEL=kernel and collect its output
+// into a malloc'd buffer. Returns NULL on failure.
+static char *runChild(const char *self, const char *kernel, size_t *len) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return NULL;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return NULL;
+    }
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        setenv("OTP_KERNEL", kernel, 1);
+        execl(self, self, "--dump", (char *)NULL);
+        perror(self);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    size_t capacity = 1 << 20;
+    char *output = malloc(capacity);
+    *len = 0;
+    while (output) {
+        if (*len == capacity) {
+            char *grown = realloc(output, capacity *= 2);
+            if (!grown) {
+                free(output);
+                output = NULL;
+                break;
+            }
+            output = grown;
+        }
+        ssize_t n = read(fds[0], output + *len, capacity - *len);
+        if (n <= 0) break;
+        *len += n;
+    }
+    close(fds[0]);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s child failed\n", kernel);
+        free(output);
+        return NULL;
+    }
+    return output;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "--dump") == 0) return dump();
+    if (argc != 2) {
+        fprintf(stderr, "USAGE: %s scalar|sse4.1|avx2\n", argv[0]);
+        return 1;
+    }
+    const char *kernel = argv[1];
+
+    size_t expectedLen, actualLen;
+    char *expected = runChild(argv[0], "scalar", &expectedLen);
+    char *actual = runChild(argv[0], kernel, &actualLen);
+    if (!expected || !actual) return 1;
+
+    // The first line names the kernel that actually ran
+    size_t nameLen = strlen(kernel);
+    if (actualLen <= nameLen || memcmp(actual, kernel, nameLen) != 0 || actual[nameLen] != '\n') {
+        printf("%s kernel not available on this CPU\n", kernel);
+        return SKIPPED;
+    }
+
+    size_t headerLen = strlen("scalar\n");
+    size_t bodyLen = expectedLen - headerLen;
+    if (actualLen - nameLen - 1 != bodyLen) {
+        printf("FAIL: %s wrote %zu bytes, scalar %zu\n", kernel, actualLen - nameLen - 1, bodyLen);
+        return 1;
+    }
+    const char *a = actual + nameLen + 1;
+    const char *e = expected + headerLen;
+    for (size_t i = 0; i < bodyLen; i++) {
+        if (a[i] != e[i]) {
+            printf("FAIL: %s differs from scalar at output byte %zu\n", kernel, i);
+            return 1;
+        }
+    }
+    printf("%s matches scalar over %zu bytes of output\n", kernel, bodyLen);
+    free(expected);
+    free(actual);
+    return 0;
+}